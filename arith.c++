@@ -0,0 +1,296 @@
+#include <string>
+#include <optional>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include "parser.h"
+#include "unification.h"
+#include "arith.h"
+
+using namespace std;
+
+struct op_name {
+	const char *name;
+	size_t      arity;
+	opcode      op;
+};
+
+static const op_name operators[] = {
+	{"+", 2,        opcode::add},
+	{"-", 2,        opcode::sub},
+	{"*", 2,        opcode::mul},
+	{"//", 2,       opcode::idiv},
+	{"rem", 2,      opcode::rem},
+	{">>", 2,       opcode::shr},
+	{"<<", 2,       opcode::shl},
+	{"/\\", 2,      opcode::band},
+	{"\\/", 2,      opcode::bor},
+	{"\\", 1,       opcode::bnot},
+	{"-", 1,        opcode::neg},
+	{"/", 2,        opcode::div},
+	{"**", 2,       opcode::pow},
+	{"abs", 1,      opcode::abs},
+	{"atan", 1,     opcode::atan},
+	{"ceiling", 1,  opcode::ceiling},
+	{"cos", 1,      opcode::cos},
+	{"exp", 1,      opcode::exp},
+	{"sqrt", 1,     opcode::sqrt},
+	{"floor", 1,    opcode::floor},
+	{"log", 1,      opcode::log},
+	{"sin", 1,      opcode::sin},
+	{"truncate", 1, opcode::truncate},
+	{"round", 1,    opcode::round}};
+
+static const op_name goals[] = {
+	{"is", 2,   opcode::is},
+	{"=:=", 2,  opcode::eq},
+	{"=\\=", 2, opcode::ne},
+	{"<", 2,    opcode::lt},
+	{">", 2,    opcode::gt},
+	{"=<", 2,   opcode::le},
+	{">=", 2,   opcode::ge}};
+
+template<size_t N>
+static optional<opcode> lookup(const op_name (&t)[N], const string &name,
+    size_t arity)
+{
+	for (auto &o : t)
+		if (o.arity == arity && name == o.name)
+			return o.op;
+	return nullopt;
+}
+
+optional<opcode> arith_op(const string &name, size_t arity)
+{
+	return lookup(operators, name, arity);
+}
+
+optional<opcode> goal_op(const string &name, size_t arity)
+{
+	return lookup(goals, name, arity);
+}
+
+/* for terms met at run time: by atom id, interned on first use */
+static optional<opcode> arith_op(const value &v)
+{
+	static const unordered_map<index_key, opcode, index_key_hash> m = [] {
+		unordered_map<index_key, opcode, index_key_hash> m;
+		for (auto &o : operators)
+			m[index_key {key_type::atom, o.arity,
+			             atom_id.get_id(o.name)}] = o.op;
+		return m;
+	}();
+	auto op = m.find(index_key {key_type::atom, v.p->n, v.p->id});
+	if (op == m.end())
+		return nullopt;
+	return op->second;
+}
+
+static number integer(int64_t i)
+{
+	number n;
+	n.integer = true;
+	n.i = i;
+	return n;
+}
+
+static number real(double d)
+{
+	number n;
+	n.integer = false;
+	n.d = d;
+	return n;
+}
+
+/* a float rounded to an integer; nothing if NaN or outside int64 */
+static optional<number> to_integer(double d)
+{
+	if (!(d >= -0x1p63 && d < 0x1p63))
+		return nullopt;
+	return integer(int64_t(d));
+}
+
+/*
+ * Apply an operator to its operands. Each operation is typed on its own
+ * operands: + - * stay integral when both sides are, the bitwise
+ * operators and // rem take integers only, / and the transcendental
+ * functions always give a float. Integers wrap around at 64 bits; a
+ * float that rounds to no int64 has no integer value.
+ */
+static optional<number> apply(opcode op, const number &l, const number &r)
+{
+	bool ints = l.integer && r.integer;
+	uint64_t a = l.i, b = r.i;
+	switch (op) {
+	case opcode::add:
+		return ints ? integer(a + b) : real(l.real() + r.real());
+	case opcode::sub:
+		return ints ? integer(a - b) : real(l.real() - r.real());
+	case opcode::mul:
+		return ints ? integer(a * b) : real(l.real() * r.real());
+	case opcode::neg:
+		return l.integer ? integer(-a) : real(-l.d);
+	case opcode::abs:
+		return l.integer ? integer(l.i < 0 ? -a : a) : real(fabs(l.d));
+	case opcode::div:      return real(l.real() / r.real());
+	case opcode::pow:      return real(pow(l.real(), r.real()));
+	case opcode::atan:     return real(atan(l.real()));
+	case opcode::cos:      return real(cos(l.real()));
+	case opcode::exp:      return real(exp(l.real()));
+	case opcode::sqrt:     return real(sqrt(l.real()));
+	case opcode::log:      return real(log(l.real()));
+	case opcode::sin:      return real(sin(l.real()));
+	case opcode::ceiling:  return to_integer(ceil(l.real()));
+	case opcode::floor:    return to_integer(floor(l.real()));
+	case opcode::truncate: return to_integer(trunc(l.real()));
+	case opcode::round:    return to_integer(round(l.real()));
+	default:
+		break;
+	}
+	if (!ints)
+		return nullopt;
+	switch (op) {
+	case opcode::shr:  return integer(l.i >> (b & 63));
+	case opcode::shl:  return integer(a << (b & 63));
+	case opcode::band: return integer(a & b);
+	case opcode::bor:  return integer(a | b);
+	case opcode::bnot: return integer(~a);
+	case opcode::idiv:
+		if (r.i == 0)
+			return nullopt;
+		if (r.i == -1)
+			return integer(-a);
+		return integer(l.i / r.i);
+	case opcode::rem:
+		if (r.i == 0)
+			return nullopt;
+		if (r.i == -1)
+			return integer(0);
+		return integer(l.i % r.i);
+	default:
+		return nullopt;
+	}
+}
+
+/* evaluate a term built at run time */
+optional<number> eval(const value &node, var_lookup &table)
+{
+	value v = table.deref(node);
+	if (v.t == tag::integer)
+		return integer(v.i);
+	if (v.t == tag::decimal)
+		return real(v.d);
+	if (v.t != tag::str)
+		return nullopt;
+	auto op = arith_op(v);
+	if (!op)
+		return nullopt;
+	optional<number> l = eval(table.arg(v, 1), table), r;
+	if (!l)
+		return nullopt;
+	if (v.p->n == 2 && !(r = eval(table.arg(v, 2), table)))
+		return nullopt;
+	return apply(*op, *l, r ? *r : integer(0));
+}
+
+value number_value(const number &n)
+{
+	value v;
+	if (n.integer) {
+		v.t = tag::integer;
+		v.i = n.i;
+	} else {
+		v.t = tag::decimal;
+		v.d = n.d;
+	}
+	return v;
+}
+
+bool compare(opcode op, const number &l, const number &r)
+{
+	if (l.integer && r.integer) {
+		switch (op) {
+		case opcode::eq: return l.i == r.i;
+		case opcode::ne: return l.i != r.i;
+		case opcode::lt: return l.i <  r.i;
+		case opcode::gt: return l.i >  r.i;
+		case opcode::le: return l.i <= r.i;
+		default:         return l.i >= r.i;
+		}
+	}
+	double a = l.real(), b = r.real();
+	switch (op) {
+	case opcode::eq: return a == b;
+	case opcode::ne: return a != b;
+	case opcode::lt: return a <  b;
+	case opcode::gt: return a >  b;
+	case opcode::le: return a <= b;
+	default:         return a >= b;
+	}
+}
+
+/*
+ * Run the program of the arithmetic goal at goal, in the frame at base.
+ * The stack is a local array: max_depth bounds it when the clause is
+ * compiled.
+ */
+control run_arith(const cell *goal, uint64_t base, var_lookup &table)
+{
+	number stack[max_depth];
+	size_t sp = 0;
+	for (const instr *i = goal->ops; ; i ++) {
+		switch (i->op) {
+		case opcode::push_int:
+			stack[sp ++] = integer(i->i);
+			continue;
+		case opcode::push_float:
+			stack[sp ++] = real(i->d);
+			continue;
+		case opcode::push_var: {
+			value v;
+			v.t = tag::ref;
+			v.id = base + i->var;
+			v = table.deref(v);
+			if (v.t == tag::integer) {
+				stack[sp ++] = integer(v.i);
+				continue;
+			}
+			optional<number> n = eval(v, table);
+			if (!n)
+				return control::fail;
+			stack[sp ++] = *n;
+			continue;
+		}
+		case opcode::is: {
+			const cell *g = goal[1].p;
+			value result = number_value(stack[0]);
+			return table.unify(arg_value(g + 1, base), result) ?
+			    control::none : control::fail;
+		}
+		case opcode::eq: case opcode::ne: case opcode::lt:
+		case opcode::gt: case opcode::le: case opcode::ge:
+			return compare(i->op, stack[0], stack[1]) ?
+			    control::none : control::fail;
+		case opcode::bnot: case opcode::neg: case opcode::abs:
+		case opcode::atan: case opcode::ceiling: case opcode::cos:
+		case opcode::exp: case opcode::sqrt: case opcode::floor:
+		case opcode::log: case opcode::sin: case opcode::truncate:
+		case opcode::round: {
+			optional<number> n = apply(i->op, stack[sp - 1],
+			    integer(0));
+			if (!n)
+				return control::fail;
+			stack[sp - 1] = *n;
+			continue;
+		}
+		default: {
+			optional<number> n = apply(i->op, stack[sp - 2],
+			    stack[sp - 1]);
+			if (!n)
+				return control::fail;
+			stack[-- sp - 1] = *n;
+			continue;
+		}
+		}
+	}
+}
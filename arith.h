@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+	using std::optional;
+	using std::string;
+	using std::vector;
+}
+
+/*
+ * Arithmetic. The goals is/2, =:=/2, =\=/2, </2, >/2, =</2 and >=/2 are
+ * compiled with their clause into a flat postfix program over a stack of
+ * numbers: operands are pushed, operators pop their arguments and push
+ * the result, and the last instruction assigns or compares. Operators are
+ * found by name when the clause is compiled, so nothing is looked up by
+ * name when the program runs. Expressions only known at run time (an
+ * operand bound to a compound) go through the same operators via eval().
+ */
+enum class opcode : uint8_t {
+	push_int, push_float, push_var,
+	add, sub, mul, idiv, rem, shr, shl, band, bor, bnot, neg,
+	div, pow, abs, atan, ceiling, cos, exp, sqrt, floor, log, sin,
+	truncate, round,
+	is, eq, ne, lt, gt, le, ge
+};
+
+struct instr {
+	opcode op;
+	union {
+		int64_t  i;
+		double   d;
+		uint64_t var;     /* clause-local id */
+	};
+};
+
+/* an integer or a float */
+struct number {
+	bool    integer;
+	union {
+		int64_t i;
+		double  d;
+	};
+	double real() const { return integer ? double(i) : d; }
+};
+
+optional<opcode> arith_op(const string &name, size_t arity);
+optional<opcode> goal_op(const string &name, size_t arity);
+const size_t max_depth = 64;    /* deepest stack a compiled program uses */
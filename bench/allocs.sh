@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Heap allocations per logical inference, measured on naive reverse of a
+# 30 element list. Each round makes 496 inferences in nrev and 2 in the
+# driving loop; the count of a run with no rounds is subtracted so that
+# loading the program does not figure.
+#
+# usage: bench/allocs.sh [path/to/prolog] [rounds]
+
+PROLOG=${1:-./prolog}
+ROUNDS=${2:-300}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cc -shared -fPIC -o "$TMP/malloc-count.so" "$ROOT/bench/malloc-count.c" ||
+	exit 1
+
+mallocs() {
+	cat > "$TMP/nrev.pl" <<PL
+app([], L, L).
+app([H|T], L, [H|R]) :- app(T, L, R).
+nrev([], []).
+nrev([H|T], R) :- nrev(T, RT), app(RT, [H], R).
+loop(0, _) :- !.
+loop(N, L) :- nrev(L, _), N1 is N - 1, loop(N1, L).
+?- loop($1, [1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,
+             21,22,23,24,25,26,27,28,29,30]).
+PL
+	LD_PRELOAD="$TMP/malloc-count.so" "$PROLOG" "$ROOT/prelude.pl" \
+		"$TMP/nrev.pl" 2>&1 > /dev/null < /dev/null |
+		awk '/^mallocs/ { print $2 }'
+}
+
+base=$(mallocs 0)
+run=$(mallocs $ROUNDS)
+echo "$ROUNDS rounds of nrev30: $((run - base)) mallocs," \
+     "$(awk "BEGIN { printf \"%.2f\", ($run - $base) / ($ROUNDS * 498) }")" \
+     "per inference"
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Arithmetic benchmark: counting and accumulator loops spend nearly all
+# their time in is/2 and the comparisons. The sum loop runs in integers
+# past 2^32, the float loop mixes types on every step.
+#
+# usage: bench/arith.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/count.pl" <<'PL'
+count(N, N) :- !.
+count(I, N) :- I < N, I1 is I + 1, count(I1, N).
+?- count(0, 1000000).
+PL
+cat > "$TMP/sum.pl" <<'PL'
+sum(I, N, S, S) :- I > N, !.
+sum(I, N, A, S) :- A1 is A + I * I, I1 is I + 1, sum(I1, N, A1, S).
+?- sum(1, 1000000, 0, S).
+PL
+cat > "$TMP/float.pl" <<'PL'
+mix(0, X, X) :- !.
+mix(N, A, X) :- A1 is A * 0.5 + N / 3 - sqrt(N), N1 is N - 1, mix(N1, A1, X).
+?- mix(1000000, 0, X).
+PL
+
+for p in count sum float; do
+	run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/$p.pl"
+	echo "$p: ${elapsed}ms peak ${peak}kB"
+done
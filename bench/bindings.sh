@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Binding store benchmark: N-queens (test24) exercises bind/unbind on
+# backtracking, count/2 and len/2 exercise deep deterministic recursion.
+# Reports wall time and peak resident set size of each run.
+#
+# usage: bench/bindings.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+sed 's/solution(12, A)/solution(9, A)/' "$ROOT/test/test24" > "$TMP/queens.pl"
+cat > "$TMP/count.pl" <<'PL'
+count(N, N) :- !.
+count(I, N) :- I1 is I + 1, count(I1, N).
+?- count(0, 20000).
+PL
+cat > "$TMP/len.pl" <<'PL'
+mklist(0, []) :- !.
+mklist(N, [N|T]) :- N1 is N - 1, mklist(N1, T).
+len(N) :- mklist(N, L), length(L, N).
+?- len(2000).
+PL
+
+for p in queens count len; do
+	run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/$p.pl"
+	echo "$p: ${elapsed}ms peak ${peak}kB"
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Clause index benchmark: 200000 first-argument lookups spread over fact
+# tables of growing size. Only the lookup query is timed, by the
+# interpreter itself (-s), so loading the table does not count; the best
+# of three runs is reported. The loop around the lookups costs the same
+# at every size, so the figure should stay flat as the table grows.
+#
+# usage: bench/index.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+lookups=200000
+
+for n in 1000 4000 16000 64000; do
+	awk -v n=$n 'BEGIN { for (i = 0; i < n; i++) printf "f(%d, v%d).\n", i, i }' \
+	    > "$TMP/facts.pl"
+	cat > "$TMP/look.pl" <<PL
+look(0) :- !.
+look(N) :- K is N rem $n, f(K, _), N1 is N - 1, look(N1).
+?- look($lookups).
+PL
+	for i in 1 2 3; do
+		"$PROLOG" -s "$ROOT/prelude.pl" "$TMP/facts.pl" "$TMP/look.pl" \
+		    < /dev/null 2>&1 > /dev/null | awk '/^% [0-9]+ inferences/ { print $4 }'
+	done | sort -n | head -1 | awk -v n=$n -v k=$lookups '
+		{ printf "facts %5d: %d lookups %7.1fms %6.0fns each\n",
+		  n, k, $1, $1 * 1000000 / k }'
+done
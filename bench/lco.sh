@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Last-call benchmark: a tail-recursive counting loop should run in
+# constant memory however many iterations it makes.
+#
+# usage: bench/lco.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+for n in 100000 1000000 10000000; do
+	cat > "$TMP/count.pl" <<PL
+count(N, N) :- !.
+count(I, N) :- I1 is I + 1, count(I1, N).
+?- count(0, $n).
+PL
+	run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/count.pl"
+	echo "count $n: ${elapsed}ms peak ${peak}kB"
+done
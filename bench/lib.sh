@@ -0,0 +1,20 @@
+# helpers shared by the benchmark scripts
+
+ms() { echo $(( $(date +%s%N) / 1000000 )); }
+
+# run_peak prog args...: run a program with stdin from /dev/null, sampling
+# VmHWM from /proc until it exits. Sets $elapsed (ms) and $peak (kB); the
+# last sample taken is reported, so very short runs under-report.
+run_peak() {
+	s=$(ms)
+	"$@" < /dev/null > /dev/null &
+	pid=$!
+	peak=0
+	while kill -0 $pid 2> /dev/null; do
+		h=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2> /dev/null)
+		[ -n "$h" ] && peak=$h
+		sleep 0.02
+	done
+	wait $pid
+	elapsed=$(( $(ms) - s ))
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Long lists: build a 100000-element list with an accumulator, unify two
+# such lists built apart, and compare two 100000-element ground lists
+# written out in clauses, with and without hash-consing. Building with
+# the occurs check on is quadratic, so it runs on shorter lists to show
+# the growth. Times are of the query alone, as reported by -s.
+#
+# usage: bench/lists.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/lists.pl" <<'PL'
+upto(0, L, L) :- !.
+upto(N, A, L) :- N1 is N - 1, upto(N1, [N|A], L).
+build(N) :- upto(N, [], _).
+same(N) :- upto(N, [], A), upto(N, [], B), A = B.
+compare(0) :- !.
+compare(K) :- big1(A), big2(B), A == B, A = B, K1 is K - 1, compare(K1).
+PL
+awk 'BEGIN { for (f = 1; f <= 2; f++) { printf "big%d([", f
+    for (i = 1; i <= 100000; i++) printf "%s%d", (i > 1 ? ", " : ""), i
+    print "])." } }' > "$TMP/big.pl"
+echo ':- set_prolog_flag(occurs_check, true).' > "$TMP/occurs.pl"
+echo ':- set_prolog_flag(hash_consing, true).' > "$TMP/share.pl"
+
+# query name flag-files...: the time of one query
+query() {
+	q=$1
+	name=$2
+	shift 2
+	echo "?- $q." > "$TMP/query.pl"
+	"$PROLOG" -s "$@" "$ROOT/prelude.pl" "$TMP/lists.pl" "$TMP/big.pl" \
+	    "$TMP/query.pl" < /dev/null 2>&1 > /dev/null |
+	    awk -v name="$name" '/inferences/ { print name ": " $4 " ms" }'
+}
+
+query "build(100000)" "build 100000"
+query "same(100000)" "build and unify 100000"
+for n in 5000 10000 20000; do
+	query "build($n)" "build $n, occurs check" "$TMP/occurs.pl"
+done
+query "compare(100)" "compare ground 100000 x100"
+query "compare(100)" "compare ground 100000 x100, hash-consed" \
+    "$TMP/share.pl"
@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Load throughput: consult generated fact files and report clauses per
+# second. The same file with one rule appended is loaded too; it cannot
+# take the parallel path for fact-only files, so the pair shows what the
+# worker threads add on this machine.
+#
+# usage: bench/load.sh [path/to/prolog] [clauses...]
+
+PROLOG=${1:-./prolog}
+shift
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+for n in ${@:-100000 1000000}; do
+	awk -v n=$n 'BEGIN { for (i = 0; i < n; i++)
+	    printf "edge(n%d, n%d, '"'"'w %d'"'"', %d.5, [a, b|T]).\n",
+	           i, (i * 7919) % n, i % 13, i % 100 }' > "$TMP/facts.pl"
+	cp "$TMP/facts.pl" "$TMP/mixed.pl"
+	echo "path(X, Y) :- edge(X, Y, _, _, _)." >> "$TMP/mixed.pl"
+	for f in facts mixed; do
+		run_peak "$PROLOG" "$TMP/$f.pl"
+		echo "$f $n: ${elapsed}ms" \
+		     "$(( n * 1000 / (elapsed > 0 ? elapsed : 1) )) clauses/s" \
+		     "peak ${peak}kB"
+	done
+done
@@ -0,0 +1,22 @@
+/*
+ * LD_PRELOAD shim counting calls to malloc; the total is written to
+ * stderr when the process exits. Build with
+ *   cc -shared -fPIC -o malloc-count.so bench/malloc-count.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t);
+
+static unsigned long long calls;
+
+void *malloc(size_t n)
+{
+	calls ++;
+	return __libc_malloc(n);
+}
+
+__attribute__((destructor)) static void report(void)
+{
+	fprintf(stderr, "mallocs %llu\n", calls);
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# OR-parallel benchmark: every solution of N-queens (test24) and of a
+# permutation search, with 1, 2, 4, ... workers up to the number of
+# cores. Speedup is the 1-worker time over the n-worker time.
+#
+# usage: bench/parallel.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+sed 's/solution(12, A)/solution(9, A)/' "$ROOT/test/test24" > "$TMP/queens.pl"
+cat > "$TMP/perm.pl" <<'PL'
+alternating([]).
+alternating([_]).
+alternating([X, Y | T]) :- X < Y, down([Y | T]).
+down([_]).
+down([X, Y | T]) :- X > Y, alternating([Y | T]).
+?- permutation([1, 2, 3, 4, 5, 6, 7, 8, 9], P), alternating(P).
+PL
+
+cores=$(nproc)
+for p in queens perm; do
+	n=1
+	while [ $n -le $cores ] || [ $n -eq 1 ]; do
+		run_peak "$PROLOG" -j $n "$ROOT/prelude.pl" "$TMP/$p.pl"
+		[ $n -eq 1 ] && one=$elapsed
+		echo "$p -j $n: ${elapsed}ms peak ${peak}kB" \
+		     "speedup $(awk "BEGIN { printf \"%.2f\", $one / $elapsed }")"
+		n=$((n * 2))
+	done
+done
@@ -0,0 +1,19 @@
+% SEND + MORE = MONEY, column by column with carries
+sel(X, [X|T], T).
+sel(X, [H|T], [H|R]) :- sel(X, T, R).
+column(A, B, Cin, S, Cout) :- T is A + B + Cin, S is T rem 10, Cout is T // 10.
+solve([S,E,N,D,M,O,R,Y]) :-
+	Ds0 = [0,1,2,3,4,5,6,7,8,9],
+	sel(D, Ds0, Ds1), sel(E, Ds1, Ds2),
+	column(D, E, 0, Y, C1), sel(Y, Ds2, Ds3),
+	sel(N, Ds3, Ds4), sel(R, Ds4, Ds5),
+	column(N, R, C1, E, C2),
+	sel(O, Ds5, Ds6),
+	column(E, O, C2, N, C3),
+	sel(S, Ds6, Ds7), S > 0, sel(M, Ds7, _), M > 0,
+	column(S, M, C3, O, M).
+all :- solve(_), fail.
+all.
+loop(0) :- !.
+loop(N) :- all, N1 is N - 1, loop(N1).
+?- loop(20).
@@ -0,0 +1,8 @@
+% naive reverse of a 30 element list, 496 inferences a pass
+app([], L, L).
+app([H|T], L, [H|R]) :- app(T, L, R).
+nrev([], []).
+nrev([H|T], R) :- nrev(T, RT), app(RT, [H], R).
+loop(0, _) :- !.
+loop(N, L) :- nrev(L, _), N1 is N - 1, loop(N1, L).
+?- loop(3000, [1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30]).
@@ -0,0 +1,22 @@
+% every solution of 8 queens, by placing one queen per column
+queens(N, Qs) :- range(1, N, Ns), place(Ns, [], Qs).
+range(N, N, [N]) :- !.
+range(M, N, [M|Ns]) :- M < N, M1 is M + 1, range(M1, N, Ns).
+place([], Qs, Qs).
+place(Unplaced, Safe, Qs) :-
+	sel(Q, Unplaced, Rest),
+	safe(Q, 1, Safe),
+	place(Rest, [Q|Safe], Qs).
+sel(X, [X|T], T).
+sel(X, [H|T], [H|R]) :- sel(X, T, R).
+safe(_, _, []).
+safe(Q, D, [Q1|Qs]) :-
+	Q =\= Q1 + D,
+	Q =\= Q1 - D,
+	D1 is D + 1,
+	safe(Q, D1, Qs).
+all :- queens(8, _), fail.
+all.
+loop(0) :- !.
+loop(N) :- all, N1 is N - 1, loop(N1).
+?- loop(10).
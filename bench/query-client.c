@@ -0,0 +1,127 @@
+/*
+ * Load generator for the query server: opens a number of connections to
+ * its socket and sends each query of a file, in turn, on every one of
+ * them, waiting for each response before the next. Prints requests and
+ * answers per second and the latency percentiles. Build with
+ *   cc -O2 -pthread -o query-client bench/query-client.c
+ *
+ * usage: query-client socket queries-file connections rounds
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *path;
+static char **queries;
+static size_t nqueries, rounds;
+static double *latency;              /* ms, one per request */
+static unsigned long long answers;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* read lines until the one starting with % that ends a response */
+static int response(FILE *in, unsigned long long *n)
+{
+	char line[1 << 16];
+	while (fgets(line, sizeof line, in)) {
+		if (line[0] == '%' && line[1] == ' ' && strstr(line, " answers"))
+			return 0;
+		if (line[0] != '%')
+			(*n) ++;
+	}
+	return -1;
+}
+
+static void *client(void *arg)
+{
+	double *lat = arg;
+	struct sockaddr_un addr = {0};
+	unsigned long long n = 0;
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	FILE *in;
+
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+	if (s < 0 || connect(s, (struct sockaddr *) &addr, sizeof addr) < 0) {
+		perror(path);
+		exit(1);
+	}
+	in = fdopen(dup(s), "r");
+	for (size_t r = 0; r < rounds; r ++) {
+		for (size_t q = 0; q < nqueries; q ++) {
+			double t = now();
+			size_t len = strlen(queries[q]);
+			if (write(s, queries[q], len) != (ssize_t) len ||
+			    response(in, &n) < 0) {
+				fprintf(stderr, "connection lost\n");
+				exit(1);
+			}
+			*lat ++ = now() - t;
+		}
+	}
+	fclose(in);
+	close(s);
+	pthread_mutex_lock(&lock);
+	answers += n;
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+static int by_value(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	char line[1 << 16];
+	size_t conns, total;
+	pthread_t *threads;
+	FILE *f;
+	double start, ms;
+
+	if (argc != 5 || !(f = fopen(argv[2], "r"))) {
+		fprintf(stderr, "usage: %s socket queries connections rounds\n",
+		    argv[0]);
+		return 1;
+	}
+	path = argv[1];
+	while (fgets(line, sizeof line, f)) {
+		queries = realloc(queries, (nqueries + 1) * sizeof *queries);
+		queries[nqueries ++] = strdup(line);
+	}
+	conns = atoi(argv[3]);
+	rounds = atoi(argv[4]);
+	total = conns * rounds * nqueries;
+	latency = malloc(total * sizeof *latency);
+	threads = malloc(conns * sizeof *threads);
+
+	start = now();
+	for (size_t i = 0; i < conns; i ++)
+		pthread_create(&threads[i], NULL, client,
+		    latency + i * rounds * nqueries);
+	for (size_t i = 0; i < conns; i ++)
+		pthread_join(threads[i], NULL);
+	ms = now() - start;
+
+	qsort(latency, total, sizeof *latency, by_value);
+	printf("%zu requests, %llu answers in %.1f ms: %.0f requests/s,"
+	    " %.0f answers/s\n", total, answers, ms, total * 1e3 / ms,
+	    answers * 1e3 / ms);
+	printf("latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+	    latency[total / 2], latency[total * 9 / 10],
+	    latency[total * 99 / 100], latency[total - 1]);
+	return 0;
+}
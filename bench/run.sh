@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# The benchmark target: the classic programs in bench/programs, each
+# timed by the interpreter itself (-s), the test corpus end to end, and
+# startup from source and from a program image. The corpus leaves out
+# test24 (every solution of 12 queens): it takes longer than everything
+# else together.
+#
+# usage: bench/run.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+for p in "$ROOT"/bench/programs/*.pl; do
+	"$PROLOG" -s "$ROOT/prelude.pl" "$p" < /dev/null > /dev/null \
+	    2> "$TMP/stats"
+	awk -v name="$(basename "$p" .pl)" '
+		/^% [0-9]+ inferences/ { n += $2; t += $4 }
+		END { printf "%-8s %10d inferences %10.1f ms %12.0f LIPS\n",
+		      name, n, t, (t > 0 ? n * 1000 / t : 0) }' "$TMP/stats"
+done | tee "$TMP/all"
+awk '{ n += $2; t += $4 }
+     END { printf "%-8s %10d inferences %10.1f ms %12.0f LIPS\n",
+           "total", n, t, (t > 0 ? n * 1000 / t : 0) }' "$TMP/all"
+
+s=$(ms)
+for t in "$ROOT"/test/test*; do
+	[ "$(basename "$t")" = test24 ] && continue
+	"$PROLOG" "$ROOT/prelude.pl" "$t" < /dev/null > /dev/null 2>&1
+done
+echo "tests:   $(( $(ms) - s ))ms"
+"$ROOT/bench/startup.sh" "$PROLOG" 3
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Query server: the program is loaded once and queries are sent to it,
+# first down standard input, then over its socket from 1 and 4
+# connections at once. Reports requests and answers per second and, for
+# the socket, latency percentiles.
+#
+# usage: bench/server.sh [path/to/prolog] [rounds]
+
+PROLOG=${1:-./prolog}
+ROUNDS=${2:-200}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'kill $server 2> /dev/null; rm -rf "$TMP"' EXIT
+
+cc -O2 -pthread -o "$TMP/query-client" "$ROOT/bench/query-client.c" ||
+    exit 1
+grep -v '^?-' "$ROOT/bench/programs/nrev.pl" > "$TMP/program.pl"
+grep -v '^?-' "$ROOT/bench/programs/queens.pl" >> "$TMP/program.pl"
+cat > "$TMP/queries" <<'PL'
+nrev([1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20], X).
+member(X, [a, b, c, d, e, f, g, h]).
+queens(6, Qs).
+app(X, Y, [1, 2, 3, 4, 5, 6]).
+PL
+
+for r in $(seq "$ROUNDS"); do cat "$TMP/queries"; done > "$TMP/stdin"
+s=$(ms)
+"$PROLOG" -S "$ROOT/prelude.pl" "$TMP/program.pl" < "$TMP/stdin" \
+    > "$TMP/out"
+e=$(( $(ms) - s ))
+awk -v ms=$e '/^% / { q ++; next } { a ++ }
+    END { printf "stdin: %d requests, %d answers in %d ms: %.0f requests/s," \
+          " %.0f answers/s (including load)\n", q, a, ms,
+          q * 1000 / ms, a * 1000 / ms }' "$TMP/out"
+
+"$PROLOG" -U "$TMP/socket" "$ROOT/prelude.pl" "$TMP/program.pl" &
+server=$!
+while [ ! -S "$TMP/socket" ]; do sleep 0.01; done
+for c in 1 4; do
+	echo "socket, $c connections:"
+	"$TMP/query-client" "$TMP/socket" "$TMP/queries" $c $ROUNDS
+done
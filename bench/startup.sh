@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Startup: the time to get to the first query, consulting source text
+# against loading a program image of the same clauses. Each is the best
+# of several runs. The generated program has rules with arithmetic so
+# the image holds compiled programs as well as terms.
+#
+# usage: bench/startup.sh [path/to/prolog] [runs]
+
+PROLOG=${1:-./prolog}
+RUNS=${2:-5}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+awk 'BEGIN { for (i = 0; i < 20000; i++)
+    printf "r%d(X, [Y|T], f(Z, g(%d))) :- Z is X * %d + 1, r%d(Z, T, Y).\n",
+           i % 500, i, i, (i + 1) % 500 }' > "$TMP/rules.pl"
+echo "?- member(X, [a])." > "$TMP/query.pl"
+"$PROLOG" -c "$TMP/prelude.img" "$ROOT/prelude.pl"
+"$PROLOG" -c "$TMP/rules.img" "$ROOT/prelude.pl" "$TMP/rules.pl"
+
+best() {
+	b=
+	for r in $(seq "$RUNS"); do
+		s=$(ms)
+		"$PROLOG" "$@" < /dev/null > /dev/null
+		e=$(( $(ms) - s ))
+		[ -z "$b" ] || [ $e -lt $b ] && b=$e
+	done
+	echo $b
+}
+
+echo "prelude text:  $(best "$ROOT/prelude.pl" "$TMP/query.pl")ms"
+echo "prelude image: $(best "$TMP/prelude.img" "$TMP/query.pl")ms"
+echo "20000 rules text:  $(best "$ROOT/prelude.pl" "$TMP/rules.pl" \
+    "$TMP/query.pl")ms"
+echo "20000 rules image: $(best "$TMP/rules.img" "$TMP/query.pl")ms"
+ls -l "$TMP"/*.img "$TMP/rules.pl" | awk '{ print $NF ": " $5 " bytes" }' |
+    sed "s|$TMP/||"
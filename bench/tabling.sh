@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Tabling benchmark: transitive closure over graphs with cycles, written
+# left recursive so it only terminates tabled, and a doubly recursive
+# fibonacci that re-derives the same subgoals exponentially untabled.
+#
+# usage: bench/tabling.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+. "$ROOT/bench/lib.sh"
+trap 'rm -rf "$TMP"' EXIT
+
+# a ring of n nodes with a chord every 7th node: path(0, X) reaches all
+graph() {
+	awk -v n=$1 'BEGIN {
+		print ":- table path/2."
+		print "path(X, Y) :- path(X, Z), edge(Z, Y)."
+		print "path(X, Y) :- edge(X, Y)."
+		for (i = 0; i < n; i ++) {
+			printf "edge(%d, %d).\n", i, (i + 1) % n
+			if (i % 7 == 0)
+				printf "edge(%d, %d).\n", i, (i * 3 + 5) % n
+		}
+		print "reach(N) :- path(0, X), X =:= N - 1, !."
+		printf "?- reach(%d).\n", n
+	}' > "$TMP/path$1.pl"
+}
+
+fib() {
+	cat > "$TMP/fib$2.pl" <<PL
+$1
+fib(0, 0).
+fib(1, 1).
+fib(N, F) :- N > 1, N1 is N - 1, N2 is N - 2,
+	fib(N1, F1), fib(N2, F2), F is F1 + F2.
+?- fib($2, F).
+PL
+}
+
+for n in 1000 5000 20000; do
+	graph $n
+	run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/path$n.pl"
+	echo "closure $n nodes: ${elapsed}ms peak ${peak}kB"
+done
+fib "" 21
+run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/fib21.pl"
+echo "fib 21 untabled: ${elapsed}ms peak ${peak}kB"
+for n in 21 1000 10000; do
+	fib ":- table fib/2." $n
+	run_peak "$PROLOG" "$ROOT/prelude.pl" "$TMP/fib$n.pl"
+	echo "fib $n tabled: ${elapsed}ms peak ${peak}kB"
+done
@@ -1,338 +1,219 @@
 #include <string>
 #include <optional>
 #include <vector>
-#include <variant>
-#include <functional>
-#include <cmath>
+#include <unordered_map>
+#include <chrono>
+#include <ctime>
 #include "parser.h"
 #include "unification.h"
 
 using namespace std;
 
-template<typename T> optional<vector<T>>
-eval_extract(composite_t &c,
-    function<optional<T>(p_bind_value &, var_lookup &)> access,
-    var_lookup &table, const char *op, size_t nargs)
+static index_key functor(const string &name, size_t arity)
 {
-	auto &f = c.get_root()->get_first();
-	auto &r = c.get_root()->get_rest();
-	if (f->get_text() != string(op) || r.size() != nargs)
-		return nullopt;
-	vector<T> build;
-	for (auto &item : r) {
-		p_bind_value v = create_bind_value(item, c.get_base(), table);
-		optional<T> a = access(v, table);
-		if (!a)
-			return vector<T>();
-		build.push_back(*a);
-	}
-	return build;
-}
-
-template<typename T> optional<T> eval(composite_t &, function<optional<T>(
-    p_bind_value &, var_lookup &)>, var_lookup &) { return nullopt; }
-
-template<typename T, typename... Args>
-optional<T> eval(composite_t &c,
-    function<optional<T>(p_bind_value &, var_lookup &)> access,
-    var_lookup &table, const char *op, function<T(T)> fn, Args... args)
-{
-	const size_t fnargs = 1;
-	optional<vector<T>> v = eval_extract(c, access, table, op, fnargs);
-	if (!v)
-		return eval<T>(c, access, table, args...);
-	if (v->size() != fnargs)
-		return nullopt;
-	return fn((*v)[0]);
+	return index_key {key_type::atom, arity, atom_id.get_id(name)};
 }
 
-template<typename T, typename... Args>
-optional<T> eval(composite_t &c,
-    function<optional<T>(p_bind_value &, var_lookup &)> access,
-    var_lookup &table, const char *op, function<T(T,T)> fn, Args... args)
+/* is/2 and the comparisons when the goal was not compiled: call/1 etc. */
+static control builtin_is(const value &goal, var_lookup &table)
 {
-	const size_t fnargs = 2;
-	optional<vector<T>> v = eval_extract(c, access, table, op, fnargs);
-	if (!v)
-		return eval<T>(c, access, table, args...);
-	if (v->size() != fnargs)
-		return nullopt;
-	return fn((*v)[0], (*v)[1]);
+	optional<number> result = eval(table.arg(goal, 2), table);
+	if (!result || !table.unify(table.arg(goal, 1), number_value(*result)))
+		return control::fail;
+	return control::none;
 }
 
-optional<p_bind_value> eval_arith(p_bind_value node, var_lookup &table)
+template<opcode C>
+static control builtin_compare(const value &goal, var_lookup &table)
 {
-	optional<int> i = node->getint(table);
-	if (i)
-		return make_shared<primitive_t<int>>(*i);
-	optional<float> f = node->getdecimal(table);
-	if (f)
-		return make_shared<primitive_t<float>>(*f);
-	return nullopt;
+	optional<number> l = eval(table.arg(goal, 1), table);
+	optional<number> r = eval(table.arg(goal, 2), table);
+	if (!l || !r || !compare(C, *l, *r))
+		return control::fail;
+	return control::none;
 }
 
-optional<int> access_int(p_bind_value &p, var_lookup &table)
+static control builtin_fail(const value &, var_lookup &)
 {
-	return p->getint(table);
+	return control::fail;
 }
 
-optional<float> access_decimal(p_bind_value &p, var_lookup &table)
+static control builtin_cut(const value &, var_lookup &)
 {
-	auto r = p->getdecimal(table);
-	auto i = p->getint(table);
-	if (r) return *r;
-	if (i) return float(*i);
-	return nullopt;
+	return control::cut;
 }
 
-#define MATH_BIN_FUNCTOR(n, f) \
-template<typename T = float> \
-struct n { T operator() (T l, T r) { return f(l, r);}}
-
-#define MATH_UNA_FUNCTOR(n, f) \
-template<typename T = float> \
-struct n { T operator() (T l) { return f(l);}}
-
-MATH_BIN_FUNCTOR(power,     powf);
-MATH_UNA_FUNCTOR(abs_f,     abs);
-MATH_UNA_FUNCTOR(atan_f,    atanf);
-MATH_UNA_FUNCTOR(ceiling_f, ceil);
-MATH_UNA_FUNCTOR(cos_f,     cosf);
-MATH_UNA_FUNCTOR(exp_f,     expf);
-MATH_UNA_FUNCTOR(sqrt_f,    sqrtf);
-MATH_UNA_FUNCTOR(floor_f,   floorf);
-MATH_UNA_FUNCTOR(log_f,     logf);
-MATH_UNA_FUNCTOR(sin_f,     sinf);
-MATH_UNA_FUNCTOR(truncate_f,truncf);
-MATH_UNA_FUNCTOR(round_f,   roundf);
-
-template<typename T = int>
-struct rshift { T operator() (T l, T r) { return l >> r;}};
-
-template<typename T = int>
-struct lshift { T operator() (T l, T r) { return l << r;}};
-
-optional<int> composite_t::getint(var_lookup &table)
+static control unify_occurs(const value &goal, var_lookup &table)
 {
-	return eval<int>(*this, access_int, table,
-	"+", plus<>(),   "-", minus<>(), "rem",modulus<>(),
-	"-", negate<>(), "*", multiplies<>(), "//", divides<>(),
-	">>",rshift<>(), "<<",lshift<>(), "/\\", bit_and<>(),
-	"\\/", bit_or<>(), "\\", bit_not<>());
+	if (table.unify(table.arg(goal, 1), table.arg(goal, 2), true))
+		return control::none;
+	return control::fail;
 }
 
-optional<float> composite_t::getdecimal(var_lookup &table)
+static control literal_compare(const value &goal, var_lookup &table)
 {
-	return eval<float>(*this, access_decimal, table,
-	"+", plus<>(),   "-", minus<>(), "-", negate<>(), "*", multiplies<>(),
-	"/", divides<>(),  "**", power<>(), "abs", abs_f<>(),
-	"atan", atan_f<>(), "ceiling", ceiling_f<>(), "cos", cos_f<>(),
-	"exp", exp_f<>(), "sqrt", sqrt_f<>(), "floor", floor_f<>(),
-	"log", log_f<>(), "sin", sin_f<>(), "truncate", truncate_f<>(),
-	"round", round_f<>());
+	if (table.identical(table.arg(goal, 1), table.arg(goal, 2)))
+		return control::none;
+	return control::fail;
 }
 
-template<typename T> optional<T> var_access(variable_t &c, var_lookup &table,
-    function<optional<T>(const p_bind_value &)> access)
+/* the list of one-character atoms spelling text, built on the heap */
+static value chars2list(const string &text, var_lookup &table)
 {
-	const p_bind_value & n = c.walk(p_bind_value {nullptr}, table);
-	if (!n)
-		return nullopt;
-	return access(n);
-}
-
-optional<int> variable_t::getint(var_lookup &t)
-{
-	return var_access<int>(*this, t,
-	[&](const p_bind_value &p) {return p->getint(t);});
-}
-
-optional<float> variable_t::getdecimal(var_lookup &t)
-{
-	return var_access<float>(*this, t,
-	[&](const p_bind_value &p){ return p->getdecimal(t);});
-}
-
-optional<builtin_t>
-builtin_is(const vector<p_term> &args, uint64_t base, var_lookup &table,
-		const string &)
-{
-	p_bind_value l = create_bind_value(args[0], base, table);
-	p_bind_value r = create_bind_value(args[1], base, table);
-	optional<p_bind_value> result = eval_arith(r, table);
-	if (!result)
-		return nullopt;
-	auto unify_rst = l->unification(*result, table, false);
-	if (!unify_rst)
-		return nullopt;
-	else
-		return make_pair(control::none, move(*unify_rst));
-}
-
-template<typename T, typename... Args>
-optional<builtin_t> _compare(const vector<p_term> &, uint64_t, var_lookup &,
-    const string &, function<optional<T>(p_bind_value &, var_lookup &)>)
-{ return nullopt; }
-
-template<typename T, typename... Args>
-optional<builtin_t> _compare(const vector<p_term> &args, uint64_t base,
-    var_lookup &table, const string &op,
-    function<optional<T>(p_bind_value &, var_lookup &)> access,
-    const char *candidate, function<bool(T,T)> fn, Args... a)
-{
-	if (string(candidate) != op)
-		return _compare<T>(args, base, table, op, access, a...);
-	p_bind_value l = create_bind_value(args[0], base, table);
-	p_bind_value r = create_bind_value(args[1], base, table);
-	optional<p_bind_value> lr = eval_arith(l, table);
-	optional<p_bind_value> rr = eval_arith(r, table);
-	if (!lr || !rr)
-		return nullopt;
-	optional<T> a0 = access(*lr, table);
-	optional<T> a1 = access(*rr, table);
-	if (a0 && a1 && fn(*a0, *a1))
-		return make_pair(control::none, vector<uint64_t>());
-	return nullopt;
-}
-
-optional<builtin_t> builtin_compare(const vector<p_term> &args, uint64_t base,
-    var_lookup &table, const string &op)
-{
-	auto rint = _compare<int>(args, base, table, op, access_int,
-		"=:=", equal_to<>(), "=\\=", not_equal_to<>(),
-		"<",   less<>(), ">", greater<>(), "=<", less_equal<>(),
-		">=",  greater_equal<>());
-	if (rint)
-		return rint;
-	auto dint = _compare<float>(args, base, table, op, access_decimal,
-		"=:=", equal_to<>(), "=\\=", not_equal_to<>(),
-		"<",   less<>(), ">", greater<>(), "=<", less_equal<>(),
-		">=",  greater_equal<>());
-	if (dint)
-		return dint;
-	return nullopt;
-}
-
-optional<builtin_t>
-builtin_fail(const vector<p_term> &, uint64_t, var_lookup &, const string &)
-{
-	return make_pair(control::fail, vector<uint64_t>());
-}
-
-optional<builtin_t>
-builtin_cut(const vector<p_term> &, uint64_t, var_lookup &, const string &)
-{
-	return make_pair(control::cut, vector<uint64_t>());
-}
-
-optional<builtin_t>
-literal_compare(const vector<p_term> &args, uint64_t base, var_lookup &table,
-		const string &)
-{
-	/* unification but don't change variable bindings */
-	auto r = unification(args[0], args[1], base, base, table, true);
-	if (r)
-		return make_pair(control::none, vector<uint64_t>());
-	else
-		return nullopt;
-}
-
-string chars2atom(string src)
-{
-	string dst;
-	if (src.size() == 0)
-		return "[]";
-	dst = ".(";
-	dst += conv2escape(string(1, src[0]));
-	dst += "," + chars2atom(src.substr(1, src.size() - 1)) + ")";
-	return dst;
-}
-
-optional<string> composite_t::atom2chars(const var_lookup &table)
-{
-	string r;
-	auto &rest = root->get_rest();
-	const string &text = root->get_first()->get_text();
-	if (rest.size() == 0) {
-		if (text == "[]")
-			return string();
-		return text;
+	value list;
+	list.t = tag::atom;
+	list.id = atom_id.get_id("[]");
+	if (text.empty())
+		return list;
+	uint64_t dot = atom_id.get_id(".");
+	cell *c = table.heap.alloc(3 * text.size());
+	for (size_t i = 0; i < text.size(); i ++, c += 3) {
+		c[0] = cell {tag::fun, dot, 2};
+		c[0].flags = cell_ground;
+		c[1] = cell {tag::atom, atom_id.get_id(string(1, text[i]))};
+		if (i + 1 < text.size())
+			c[2] = cell {c + 3};
+		else
+			c[2] = cell {tag::atom, list.id};
 	}
-	if (text != "." || rest.size() != 2)
-		return nullopt;
-	p_bind_value b0 = create_bind_value(rest[0], base, table);
-	optional<string> a0 = b0->atom2chars(table);
-	p_bind_value b1 = create_bind_value(rest[1], base, table);
-	optional<string> a1 = b1->atom2chars(table);
-	if (!a0 || !a1)
-		return nullopt;
-	if (a0->size() != 1)
-		return nullopt;
-	return *a0 + *a1;
+	list.t = tag::str;
+	list.p = c - 3 * text.size();
+	return list;
 }
 
-optional<builtin_t>
-atom2chars(const vector<p_term> &args, uint64_t base, var_lookup &table,
-		const string &)
+static optional<string> list2chars(value v, var_lookup &table)
 {
-	p_bind_value b0 = create_bind_value(args[0], base, table);
-	p_bind_value b1 = create_bind_value(args[1], base, table);
-	optional<string> s;
-	string t;
-	if ((s = b0->getname(table))) {
-		t = chars2atom(*s);
-	} else {
-		b0.swap(b1);
-		optional<string> m = b0->getname(table);
-		if (!m)
+	string text;
+	for (; v.t == tag::str; v = table.arg(v, 2)) {
+		if (v.p->n != 2 || atom_id.get_name(v.p->id) != ".")
 			return nullopt;
-		if ((*m != "." && *m != "[]") || !(s = b0->atom2chars(table)))
+		value c = table.arg(v, 1);
+		if (c.t != tag::atom || atom_id.get_name(c.id).size() != 1)
 			return nullopt;
-		t = conv2escape(*s);
+		text += atom_id.get_name(c.id);
 	}
-	optional<p_term> p = external_parse_term(t);
-	assert(p);
-	b0 = create_bind_value(*p, base, table);
-	auto r = b1->unification(b0, table, false);
-	if (!r)
+	if (v.t != tag::atom || atom_id.get_name(v.id) != "[]")
 		return nullopt;
-	return make_pair(control::none, move(*r));
+	return text;
 }
 
-using builtin_fn = optional<builtin_t>(*)(const vector<p_term> &,
-        uint64_t, var_lookup &, const string &);
-unordered_map<string, pair<builtin_fn, uint32_t>> builtin_map = {
-	{ "is",         {builtin_is,      2}},
-	{ "=:=",        {builtin_compare, 2}},
-	{ "=\\=",       {builtin_compare, 2}},
-	{ "<",          {builtin_compare, 2}},
-	{ ">",          {builtin_compare, 2}},
-	{ "=<",         {builtin_compare, 2}},
-	{ ">=",         {builtin_compare, 2}},
-	{ "==",         {literal_compare, 2}},
-	{ "!",          {builtin_cut,     0}},
-	{ "fail",       {builtin_fail,    0}},
-	{ "atom_chars", {atom2chars,      2}}
-};
-
-optional<builtin_t>
-composite_t::builtin(uint64_t base, var_lookup &table)
+static control atom2chars(const value &goal, var_lookup &table)
 {
-	auto m = builtin_map.find(get_root()->get_first()->get_text());
-	if (m == builtin_map.end())
-		return nullopt;
-	builtin_fn f = m->second.first;
-	if (m->second.second != get_root()->get_rest().size() || !f)
-		return nullopt;
-	auto r = f(get_root()->get_rest(), base, table, m->first);
-	return r;
-}
-
-optional<builtin_t>
-builtin(const p_term &term, uint64_t base, var_lookup &table)
-{
-	vector<uint64_t> nil = vector<uint64_t>();
-
-	p_bind_value value = create_bind_value(term, base, table);
-	return value->builtin(base, table);
+	value a = table.arg(goal, 1), l = table.arg(goal, 2);
+	if (a.t == tag::atom) {
+		value chars = chars2list(atom_id.get_name(a.id), table);
+		return table.unify(l, chars) ? control::none : control::fail;
+	}
+	optional<string> s = list2chars(l, table);
+	if (!s)
+		return control::fail;
+	value atom;
+	atom.t = tag::atom;
+	atom.id = atom_id.get_id(*s);
+	return table.unify(a, atom) ? control::none : control::fail;
+}
+
+static value integer_value(int64_t i)
+{
+	value v;
+	v.t = tag::integer;
+	v.i = i;
+	return v;
+}
+
+/* [a, b] on the heap */
+static value pair_list(int64_t a, int64_t b, var_lookup &table)
+{
+	uint64_t dot = atom_id.get_id(".");
+	cell *c = table.heap.alloc(6);
+	c[0] = cell {tag::fun, dot, 2};
+	c[1] = cell {a};
+	c[2] = cell {c + 3};
+	c[3] = cell {tag::fun, dot, 2};
+	c[4] = cell {b};
+	c[5] = cell {tag::atom, atom_id.get_id("[]")};
+	c[0].flags = c[3].flags = cell_ground;
+	value list;
+	list.t = tag::str;
+	list.p = c;
+	return list;
+}
+
+static const auto started = chrono::steady_clock::now();
+
+/* milliseconds of cpu time, and since the program started */
+static int64_t cpu_ms()
+{
+	return int64_t(clock()) * 1000 / CLOCKS_PER_SEC;
+}
+
+static int64_t wall_ms()
+{
+	return chrono::duration_cast<chrono::milliseconds>(
+	    chrono::steady_clock::now() - started).count();
+}
+
+/*
+ * statistics(Key, Value): the engine's counters since the program
+ * started, the size of the binding store and trail, the number of atoms,
+ * and runtime, walltime ([Total, SinceLast] in ms) and cputime (seconds).
+ */
+static control statistics(const value &goal, var_lookup &table)
+{
+	static thread_local int64_t last_cpu, last_wall;
+	value key = table.arg(goal, 1), v;
+	if (key.t != tag::atom)
+		return control::fail;
+	const string &name = atom_id.get_name(key.id);
+	counters c = table.lifetime();
+	const pair<const char *, uint64_t> counts[] = {
+		{"inferences",    c.inferences},
+		{"unifications",  c.unifications},
+		{"bindings",      c.bindings},
+		{"choicepoints",  c.choicepoints},
+		{"backtracks",    c.backtracks},
+		{"cuts",          c.cuts},
+		{"binding_table", table.slots_size()},
+		{"trail",         table.trail_size()},
+		{"atoms",         atom_id.max()}};
+	for (auto &k : counts)
+		if (name == k.first)
+			v = integer_value(k.second);
+	if (name == "runtime") {
+		int64_t now = cpu_ms();
+		v = pair_list(now, now - last_cpu, table);
+		last_cpu = now;
+	} else if (name == "walltime") {
+		int64_t now = wall_ms();
+		v = pair_list(now, now - last_wall, table);
+		last_wall = now;
+	} else if (name == "cputime") {
+		v.t = tag::decimal;
+		v.d = double(clock()) / CLOCKS_PER_SEC;
+	}
+	if (v.t == tag::none)
+		return control::fail;
+	return table.unify(table.arg(goal, 2), v) ? control::none :
+	    control::fail;
+}
+
+/* built lazily: the names are interned on first use */
+builtin_fn find_builtin(const index_key &pred)
+{
+	static const unordered_map<index_key, builtin_fn, index_key_hash> m = {
+		{functor("is", 2),         builtin_is},
+		{functor("=:=", 2),        builtin_compare<opcode::eq>},
+		{functor("=\\=", 2),       builtin_compare<opcode::ne>},
+		{functor("<", 2),          builtin_compare<opcode::lt>},
+		{functor(">", 2),          builtin_compare<opcode::gt>},
+		{functor("=<", 2),         builtin_compare<opcode::le>},
+		{functor(">=", 2),         builtin_compare<opcode::ge>},
+		{functor("==", 2),         literal_compare},
+		{functor("!", 0),          builtin_cut},
+		{functor("fail", 0),       builtin_fail},
+		{functor("atom_chars", 2), atom2chars},
+		{functor("statistics", 2), statistics},
+		{functor("unify_with_occurs_check", 2), unify_occurs}};
+	auto b = m.find(pred);
+	return b == m.end() ? nullptr : b->second;
 }
@@ -0,0 +1,228 @@
+#include <vector>
+#include <utility>
+#include <string>
+#include "parser.h"
+#include "cell.h"
+
+using namespace std;
+
+class compiler {
+private:
+	vector<cell>               &cells;
+	vector<instr>              &ops;
+	vector<pair<size_t,size_t>> links;   /* str cell, fun cell */
+	vector<pair<size_t,size_t>> progs;   /* arith cell, first instr */
+	bool expr(const p_term &, size_t);
+	bool arith(const p_term &);
+public:
+	uint64_t nvars;
+	compiler(vector<cell> &c, vector<instr> &o) :
+		cells {c}, ops {o}, nvars {0} {}
+	size_t root(const p_term &t) {
+		size_t at = cells.size();
+		cells.emplace_back();
+		put(at, t);
+		return at;
+	}
+	size_t goal(const p_term &t);
+	void put(size_t at, const p_term &t);
+	void link() {
+		for (auto &l : links)
+			cells[l.first].p = &cells[l.second];
+		for (auto &l : progs)
+			cells[l.first].ops = &ops[l.second];
+	}
+};
+
+/* push the code for an expression whose value lands at depth */
+bool compiler::expr(const p_term &t, size_t depth)
+{
+	const unique_ptr<token> &tok = t->get_first();
+	auto &rest = t->get_rest();
+	instr i;
+	if (depth >= max_depth)
+		return false;
+	switch (tok->get_type()) {
+	case symbol::integer:
+		i.op = opcode::push_int;
+		i.i = tok->get_int_value();
+		break;
+	case symbol::decimal:
+		i.op = opcode::push_float;
+		i.d = tok->get_decimal_value();
+		break;
+	case symbol::variable:
+		i.op = opcode::push_var;
+		i.var = tok->id;
+		break;
+	default: {
+		auto op = arith_op(tok->get_text(), rest.size());
+		if (!op)
+			return false;
+		for (size_t k = 0; k < rest.size(); k ++)
+			if (!expr(rest[k], depth + k))
+				return false;
+		i.op = *op;
+		break;
+	}
+	}
+	ops.push_back(i);
+	return true;
+}
+
+/* the program for an arithmetic goal, if t is one */
+bool compiler::arith(const p_term &t)
+{
+	auto &rest = t->get_rest();
+	auto op = goal_op(t->get_first()->get_text(), rest.size());
+	size_t start = ops.size();
+	if (!op || t->get_first()->get_type() != symbol::atom)
+		return false;
+	if (*op == opcode::is ? !expr(rest[1], 0) :
+	    !expr(rest[0], 0) || !expr(rest[1], 1)) {
+		ops.resize(start);
+		return false;
+	}
+	instr i;
+	i.op = *op;
+	i.i = 0;
+	ops.push_back(i);
+	return true;
+}
+
+size_t compiler::goal(const p_term &t)
+{
+	size_t start = ops.size();
+	if (!arith(t))
+		return root(t);
+	size_t at = cells.size();
+	cells.emplace_back(tag::arith, 0);
+	progs.push_back(make_pair(at, start));
+	root(t);
+	return at;
+}
+
+/* compounds are laid out depth first, each after its parent's arguments */
+void compiler::put(size_t root, const p_term &term)
+{
+	vector<pair<size_t, const p_term *>> walk {{root, &term}};
+	while (!walk.empty()) {
+		size_t at = walk.back().first;
+		const p_term &t = *walk.back().second;
+		walk.pop_back();
+		const unique_ptr<token> &tok = t->get_first();
+		auto &rest = t->get_rest();
+		switch (tok->get_type()) {
+		case symbol::integer:
+			cells[at] = cell {tok->get_int_value()};
+			continue;
+		case symbol::decimal:
+			cells[at] = cell {tok->get_decimal_value()};
+			continue;
+		case symbol::variable:
+			cells[at] = cell {tag::var, tok->id};
+			if (tok->id > nvars)
+				nvars = tok->id;
+			continue;
+		default:
+			break;
+		}
+		if (rest.empty()) {
+			cells[at] = cell {tag::atom, tok->id};
+			continue;
+		}
+		size_t f = cells.size();
+		cells.resize(f + 1 + rest.size());
+		cells[f] = cell {tag::fun, tok->id, uint32_t(rest.size())};
+		if (t->is_ground())
+			cells[f].flags |= cell_ground;
+		cells[at].t = tag::str;
+		links.push_back(make_pair(at, f));
+		for (size_t i = rest.size(); i > 0; i --)
+			walk.emplace_back(f + i, &rest[i - 1]);
+	}
+}
+
+static bool is_conjunction(const p_term &t)
+{
+	const unique_ptr<token> &tok = t->get_first();
+	return tok->get_type() == symbol::atom && tok->get_text() == "," &&
+	    t->get_rest().size() == 2;
+}
+
+/*
+ * A conjunction in brackets is compiled as the goals it joins, so a cut
+ * in it cuts the clause. Only a conjunction called through a variable is
+ * left to the ','/2 of the prelude.
+ */
+p_code compile(const p_term &head, const vector<p_term> &body)
+{
+	p_code c = make_unique<code>();
+	compiler comp {c->cells, c->ops};
+	size_t h = head ? comp.root(head) : 0;
+	vector<size_t> goals;
+	vector<const p_term *> walk;
+	for (auto g = body.rbegin(); g != body.rend(); g ++)
+		walk.push_back(&*g);
+	while (!walk.empty()) {
+		const p_term &g = *walk.back();
+		walk.pop_back();
+		if (is_conjunction(g)) {
+			walk.push_back(&g->get_rest()[1]);
+			walk.push_back(&g->get_rest()[0]);
+		} else
+			goals.push_back(comp.goal(g));
+	}
+	comp.link();
+	c->head = head ? &c->cells[h] : nullptr;
+	for (auto g : goals)
+		c->body.push_back(&c->cells[g]);
+	c->nvars = comp.nvars;
+	return c;
+}
+
+/* code compiled against another atom table: map its ids to ours */
+void rename_atoms(code &c, const vector<uint64_t> &map)
+{
+	for (auto &i : c.cells)
+		if (i.t == tag::atom || i.t == tag::fun)
+			i.id = map[i.id];
+}
+
+/* fun cells come before the compounds among their arguments: go backwards */
+void ground_terms::share(code &c)
+{
+	vector<cell> &cells = c.cells;
+	vector<const cell *> to(cells.size(), nullptr);
+	auto shared = [&](cell k) {
+		if (k.t == tag::str && to[k.p - cells.data()])
+			k.p = to[k.p - cells.data()];
+		return k;
+	};
+	string key;
+
+	for (size_t f = cells.size(); f -- > 0; ) {
+		if (cells[f].t != tag::fun || !cells[f].is_ground())
+			continue;
+		size_t n = cells[f].n;
+		key.clear();
+		for (size_t i = 0; i <= n; i ++) {
+			cell k = shared(cells[f + i]);
+			key.push_back(char(k.t));
+			key.append(reinterpret_cast<const char *>(&k.n),
+			    sizeof k.n);
+			key.append(reinterpret_cast<const char *>(&k.id),
+			    sizeof k.id);
+		}
+		const cell *&one = interned[key];
+		if (!one) {
+			blocks.emplace_back();
+			for (size_t i = 0; i <= n; i ++)
+				blocks.back().push_back(shared(cells[f + i]));
+			one = blocks.back().data();
+		}
+		to[f] = one;
+	}
+	for (auto &k : cells)
+		k = shared(k);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include "parser.h"
+#include "arith.h"
+
+namespace {
+	using std::vector;
+	using std::deque;
+	using std::string;
+	using std::unique_ptr;
+	using std::unordered_map;
+}
+
+/*
+ * Compiled terms. A clause is flattened once, when it is loaded, into a
+ * contiguous block of cells. A compound is a fun cell (functor and arity)
+ * followed by one cell per argument; an argument that is itself compound
+ * is a str cell pointing at its fun cell. Variables are var cells holding
+ * the clause-local id, so the code is shared by every activation and only
+ * the frame base differs.
+ *
+ * Terms built while running (atom_chars) use the same cells on the heap,
+ * with ref cells naming a variable by its absolute id.
+ *
+ * An arithmetic goal in a clause body is an arith cell pointing at its
+ * compiled program, followed by the str cell of the goal itself.
+ */
+enum class tag : uint8_t { none, ref, var, atom, integer, decimal, str, fun,
+                           arith };
+
+const uint8_t cell_ground = 1;    /* fun: no variables below */
+
+struct cell {
+	tag      t;
+	uint8_t  flags;
+	uint32_t n;                   /* fun: arity */
+	union {
+		uint64_t    id;       /* atom, fun: atom id; var, ref: var id */
+		int64_t     i;
+		double      d;
+		const cell *p;        /* str */
+		const instr *ops;     /* arith */
+	};
+	cell() : t {tag::none}, flags {0}, n {0}, id {0} {}
+	cell(tag _t, uint64_t _id, uint32_t _n = 0) :
+		t {_t}, flags {0}, n {_n}, id {_id} {}
+	explicit cell(int64_t v) : t {tag::integer}, flags {0}, n {0}, i {v} {}
+	explicit cell(double v) : t {tag::decimal}, flags {0}, n {0}, d {v} {}
+	explicit cell(const cell *s) : t {tag::str}, flags {0}, n {0}, p {s} {}
+	bool is_ground() const { return flags & cell_ground; }
+};
+
+/*
+ * A term as seen at run time: an unbound variable (ref), a constant, or a
+ * compound (str) given by its fun cell and the base its var cells are
+ * relative to. Binding slots hold values, so no cell is ever copied to
+ * bind a variable.
+ */
+struct value {
+	tag t;
+	union {
+		uint64_t    id;
+		int64_t     i;
+		double      d;
+		const cell *p;
+	};
+	uint64_t base;
+	value() : t {tag::none}, id {0}, base {0} {}
+};
+
+/* the value an argument cell stands for, before dereferencing */
+inline value arg_value(const cell *c, uint64_t base)
+{
+	value v;
+	v.t = c->t;
+	v.id = c->id;
+	switch (c->t) {
+	case tag::var:
+		v.t = tag::ref;
+		v.id = base + c->id;
+		break;
+	case tag::str:
+		v.base = base;
+		break;
+	default:
+		break;
+	}
+	return v;
+}
+
+/* a clause, or a query when head is null */
+class code {
+public:
+	vector<cell>         cells;
+	vector<instr>        ops;
+	const cell          *head;
+	vector<const cell *> body;
+	uint64_t             nvars;
+};
+using p_code = unique_ptr<code>;
+
+p_code compile(const p_term &head, const vector<p_term> &body);
+void rename_atoms(code &, const vector<uint64_t> &);
+
+/*
+ * Hash-consing of ground terms. Each ground compound of a clause is looked
+ * up by its fun cell and arguments, compound arguments having been shared
+ * first, and the clause is pointed at the one copy kept here. Equal
+ * ground terms anywhere in the program are then the same cells, so they
+ * unify and compare by pointer.
+ */
+class ground_terms {
+private:
+	unordered_map<string, const cell *> interned;
+	deque<vector<cell>>                 blocks;
+public:
+	void share(code &);
+};
@@ -0,0 +1,389 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <unordered_map>
+#include "parser.h"
+#include "image.h"
+
+using namespace std;
+
+static const char magic[8] = {'\x7f', 'P', 'L', 'I', 'M', 'G', '\0', '2'};
+
+struct header {
+	char     magic[8];
+	uint32_t cell_size;
+	uint32_t instr_size;
+	uint64_t atoms;
+	uint64_t ops;
+	uint64_t tabled;
+	uint64_t clauses;
+	uint32_t workers;
+	uint8_t  ordered;
+	uint8_t  occurs_check;
+	uint8_t  hash_consing;
+	uint8_t  unused;
+};
+
+/* per clause, followed by its body, cells and instructions */
+struct clause_header {
+	uint64_t nvars;
+	uint64_t head;
+	uint64_t body;
+	uint64_t cells;
+	uint64_t ops;
+};
+
+template<typename T>
+static void put(string &out, const T &x)
+{
+	out.append(reinterpret_cast<const char *>(&x), sizeof x);
+}
+
+static void put_name(string &out, const string &name)
+{
+	put(out, uint32_t(name.size()));
+	out += name;
+}
+
+/*
+ * The cells of a clause with str cells as indices. A hash-consed clause
+ * points into terms shared with others: those are copied in after its
+ * own cells, once each.
+ */
+static vector<cell> flatten(const code &c)
+{
+	const cell *lo = c.cells.data(), *hi = lo + c.cells.size();
+	vector<cell> cells = c.cells;
+	unordered_map<const cell *, uint64_t> copied;
+	for (size_t k = 0; k < cells.size(); k ++) {
+		if (cells[k].t != tag::str)
+			continue;
+		const cell *p = cells[k].p;
+		if (p >= lo && p < hi) {
+			cells[k].id = p - lo;
+			continue;
+		}
+		auto i = copied.find(p);
+		if (i == copied.end()) {
+			i = copied.emplace(p, cells.size()).first;
+			cells.insert(cells.end(), p, p + p->n + 1);
+		}
+		cells[k].id = i->second;
+	}
+	return cells;
+}
+
+/* padding is zeroed so the same program always gives the same image */
+static void put_cell(string &out, const cell &c, const instr *ops)
+{
+	cell z;
+	memset(static_cast<void *>(&z), 0, sizeof z);
+	z.t = c.t;
+	z.flags = c.flags;
+	z.n = c.n;
+	z.id = c.id;
+	if (c.t == tag::arith)
+		z.id = c.ops - ops;
+	put(out, z);
+}
+
+static void put_instr(string &out, const instr &i)
+{
+	instr z;
+	memset(static_cast<void *>(&z), 0, sizeof z);
+	z.op = i.op;
+	if (i.op == opcode::push_int || i.op == opcode::push_float ||
+	    i.op == opcode::push_var)
+		z.i = i.i;       /* the operand of anything else is unset */
+	put(out, z);
+}
+
+string save_image(const clause_index &index, const vector<op_entry> &ops,
+    const image_flags &flags)
+{
+	string out;
+	header h;
+	memcpy(h.magic, magic, sizeof magic);
+	h.cell_size = sizeof(cell);
+	h.instr_size = sizeof(instr);
+	h.atoms = atom_id.max();
+	h.ops = ops.size();
+	h.tabled = index.tables().size();
+	h.clauses = index.all().size();
+	h.workers = flags.workers;
+	h.ordered = flags.ordered;
+	h.occurs_check = flags.occurs_check;
+	h.hash_consing = flags.hash_consing;
+	h.unused = 0;
+	put(out, h);
+	for (uint64_t id = 1; id <= h.atoms; id ++)
+		put_name(out, atom_id.get_name(id));
+	for (auto &o : ops) {
+		put_name(out, o.name);
+		put(out, o.assoc);
+		put(out, o.priority);
+	}
+	for (auto &t : index.tables()) {
+		put(out, uint64_t(t.arity));
+		put(out, t.value);
+	}
+	for (auto &c : index.all()) {
+		const cell *base = c->cells.data();
+		vector<cell> cells = flatten(*c);
+		clause_header ch {c->nvars, uint64_t(c->head - base),
+		    c->body.size(), cells.size(), c->ops.size()};
+		put(out, ch);
+		for (auto g : c->body)
+			put(out, uint64_t(g - base));
+		for (auto &i : cells)
+			put_cell(out, i, c->ops.data());
+		for (auto &i : c->ops)
+			put_instr(out, i);
+	}
+	return out;
+}
+
+bool is_image(const string &text)
+{
+	return text.size() >= sizeof magic &&
+	    !memcmp(text.data(), magic, sizeof magic);
+}
+
+/* reads out of the image, failing rather than running off its end */
+class reader {
+private:
+	const char *p, *end;
+public:
+	reader(const string &s) : p {s.data()}, end {s.data() + s.size()} {}
+	bool get(void *to, size_t n) {
+		if (size_t(end - p) < n)
+			return false;
+		memcpy(to, p, n);
+		p += n;
+		return true;
+	}
+	template<typename T> bool get(T &x) { return get(&x, sizeof x); }
+	/* whether n items of at least size bytes each can still follow */
+	bool fits(uint64_t n, size_t size) const {
+		return n <= size_t(end - p) / size;
+	}
+	bool get(string &name) {
+		uint32_t n;
+		if (!get(n) || size_t(end - p) < n)
+			return false;
+		name.assign(p, n);
+		p += n;
+		return true;
+	}
+};
+
+/* is the program at ops[at] one compile() could have made for the clause */
+static bool valid_program(const vector<instr> &ops, uint64_t at,
+    uint64_t nvars)
+{
+	size_t sp = 0;
+	for (; at < ops.size(); at ++) {
+		const instr &i = ops[at];
+		switch (i.op) {
+		case opcode::push_var:
+			if (i.var == 0 || i.var > nvars)
+				return false;
+			/* fall through */
+		case opcode::push_int:
+		case opcode::push_float:
+			if (++ sp > max_depth)
+				return false;
+			continue;
+		case opcode::is:
+			return sp == 1;
+		case opcode::eq: case opcode::ne: case opcode::lt:
+		case opcode::gt: case opcode::le: case opcode::ge:
+			return sp == 2;
+		case opcode::bnot: case opcode::neg: case opcode::abs:
+		case opcode::atan: case opcode::ceiling: case opcode::cos:
+		case opcode::exp: case opcode::sqrt: case opcode::floor:
+		case opcode::log: case opcode::sin: case opcode::truncate:
+		case opcode::round:
+			if (sp < 1)
+				return false;
+			continue;
+		default:
+			if (i.op > opcode::ge || sp < 2)
+				return false;
+			sp --;
+			continue;
+		}
+	}
+	return false;
+}
+
+/* no compound of the clause contains itself */
+static bool acyclic(const vector<cell> &cells)
+{
+	enum : uint8_t { unseen, open, done };
+	vector<uint8_t> state(cells.size(), unseen);
+	vector<pair<size_t, size_t>> walk;   /* fun cell, next argument */
+	for (size_t f = 0; f < cells.size(); f ++) {
+		if (cells[f].t != tag::fun || state[f] != unseen)
+			continue;
+		state[f] = open;
+		walk.emplace_back(f, 1);
+		while (!walk.empty()) {
+			auto &w = walk.back();
+			if (w.second > cells[w.first].n) {
+				state[w.first] = done;
+				walk.pop_back();
+				continue;
+			}
+			const cell &a = cells[w.first + w.second ++];
+			if (a.t != tag::str || state[a.id] == done)
+				continue;
+			if (state[a.id] == open)
+				return false;
+			state[a.id] = open;
+			walk.emplace_back(a.id, 1);
+		}
+	}
+	return true;
+}
+
+/*
+ * Is a clause read from an image one compile() could have made: every
+ * tag known, every compound's arguments inside the clause and no
+ * compound inside itself, every variable in the frame, every atom in the
+ * image, and every arithmetic program ending in a goal over a stack that
+ * stays within max_depth. The engine trusts all of these.
+ */
+static bool valid_clause(const clause_header &ch, const vector<uint64_t> &body,
+    const vector<cell> &cells, const vector<instr> &ops, uint64_t atoms)
+{
+	auto is_fun = [&](uint64_t k) {
+		return k < cells.size() && cells[k].t == tag::fun;
+	};
+	auto goal = [&](uint64_t k) {
+		return k < cells.size() && cells[k].t != tag::fun &&
+		    cells[k].t != tag::none;
+	};
+	if (ch.nvars > cells.size() || !goal(ch.head))
+		return false;
+	for (auto g : body)
+		if (!goal(g))
+			return false;
+	for (size_t k = 0; k < cells.size(); k ++) {
+		const cell &c = cells[k];
+		if (c.flags & ~cell_ground)
+			return false;
+		switch (c.t) {
+		case tag::var:
+			if (c.id == 0 || c.id > ch.nvars)
+				return false;
+			break;
+		case tag::integer:
+		case tag::decimal:
+			break;
+		case tag::atom:
+			if (c.id == 0 || c.id > atoms)
+				return false;
+			break;
+		case tag::fun:
+			if (c.id == 0 || c.id > atoms ||
+			    c.n >= cells.size() - k)
+				return false;
+			break;
+		case tag::str:
+			if (!is_fun(c.id))
+				return false;
+			break;
+		case tag::arith:
+			/* followed by the str cell of its goal, an arity 2 one */
+			if (k + 1 == cells.size() ||
+			    cells[k + 1].t != tag::str ||
+			    !is_fun(cells[k + 1].id) ||
+			    cells[cells[k + 1].id].n != 2 ||
+			    !valid_program(ops, c.id, ch.nvars))
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return acyclic(cells);
+}
+
+bool load_image(const string &text, clause_index &index,
+    vector<op_entry> &ops, image_flags &flags)
+{
+	reader in {text};
+	header h;
+	if (!in.get(h) || memcmp(h.magic, magic, sizeof magic) ||
+	    h.cell_size != sizeof(cell) || h.instr_size != sizeof(instr) ||
+	    h.ordered > 1 || h.occurs_check > 1 || h.hash_consing > 1)
+		return false;
+	/* counts are checked against what is left before anything is sized */
+	if (!in.fits(h.atoms, sizeof(uint32_t)))
+		return false;
+
+	vector<string> names(h.atoms);
+	vector<pair<uint64_t, uint64_t>> tabled;
+	vector<p_code> clauses;
+	for (auto &name : names)
+		if (!in.get(name))
+			return false;
+	for (uint64_t i = 0; i < h.ops; i ++) {
+		op_entry o;
+		if (!in.get(o.name) || !in.get(o.assoc) || !in.get(o.priority))
+			return false;
+		ops.push_back(move(o));
+	}
+	for (uint64_t i = 0; i < h.tabled; i ++) {
+		uint64_t arity, id;
+		if (!in.get(arity) || !in.get(id) || id == 0 || id > h.atoms)
+			return false;
+		tabled.emplace_back(arity, id);
+	}
+	for (uint64_t i = 0; i < h.clauses; i ++) {
+		clause_header ch;
+		if (!in.get(ch) || !in.fits(ch.body, sizeof(uint64_t)) ||
+		    !in.fits(ch.cells, sizeof(cell)) ||
+		    !in.fits(ch.ops, sizeof(instr)))
+			return false;
+		p_code c = make_unique<code>();
+		vector<uint64_t> body(ch.body);
+		c->cells.resize(ch.cells);
+		c->ops.resize(ch.ops);
+		if (!in.get(body.data(), body.size() * sizeof(uint64_t)) ||
+		    !in.get(c->cells.data(), ch.cells * sizeof(cell)) ||
+		    !in.get(c->ops.data(), ch.ops * sizeof(instr)) ||
+		    !valid_clause(ch, body, c->cells, c->ops, h.atoms))
+			return false;
+		for (auto &k : c->cells) {
+			if (k.t == tag::str)
+				k.p = &c->cells[k.id];
+			else if (k.t == tag::arith)
+				k.ops = &c->ops[k.id];
+		}
+		c->head = &c->cells[ch.head];
+		for (auto g : body)
+			c->body.push_back(&c->cells[g]);
+		c->nvars = ch.nvars;
+		clauses.push_back(move(c));
+	}
+
+	/* nothing is added from an image that turns out to be damaged */
+	vector<uint64_t> map(h.atoms + 1);
+	for (uint64_t id = 1; id <= h.atoms; id ++)
+		map[id] = atom_id.get_id(names[id - 1]);
+	for (auto &t : tabled)
+		index.table(index_key {key_type::atom, t.first, map[t.second]});
+	for (auto &c : clauses) {
+		for (auto &k : c->cells)
+			if (k.t == tag::atom || k.t == tag::fun)
+				k.id = map[k.id];
+		index.add(move(c));
+	}
+	flags.workers = h.workers;
+	flags.ordered = h.ordered;
+	flags.occurs_check = h.occurs_check;
+	flags.hash_consing = h.hash_consing;
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "index.h"
+
+namespace {
+	using std::string;
+	using std::vector;
+}
+
+/*
+ * Program images. A loaded program is saved as the atom names, the
+ * operator table, the tabled predicates, the settings its directives
+ * left and the compiled cells of every clause in the order they were
+ * added, with pointers written as indices into their clause. Loading one
+ * is a bulk copy of each clause plus a pass to check it, relink pointers
+ * and map atom ids to those of this run: nothing is scanned or parsed.
+ * A damaged image is rejected whole, before any of its atoms is made.
+ *
+ * Cells are written as they are in memory, so an image is only read by
+ * a build with the same layout: the header has a format version and the
+ * sizes of a cell and an instruction.
+ */
+struct op_entry {
+	string   name;
+	uint32_t assoc;
+	int32_t  priority;
+};
+
+/* set_prolog_flag and parallel directives as they stood at the end */
+struct image_flags {
+	uint32_t workers;        /* 0: no parallel directive */
+	bool     ordered;
+	bool     occurs_check;
+	bool     hash_consing;
+};
+
+bool is_image(const string &);
+string save_image(const clause_index &, const vector<op_entry> &,
+    const image_flags &);
+bool load_image(const string &, clause_index &, vector<op_entry> &,
+    image_flags &);
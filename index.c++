@@ -0,0 +1,86 @@
+#include <vector>
+#include <cstring>
+#include "index.h"
+
+using namespace std;
+
+index_key number_key(int64_t v)
+{
+	return index_key {key_type::integer, 0, uint64_t(v)};
+}
+
+/* -0.0 unifies with 0.0, so both take the key of 0.0 */
+index_key number_key(double v)
+{
+	uint64_t bits;
+	if (v == 0)
+		v = 0.0;
+	memcpy(&bits, &v, sizeof bits);
+	return index_key {key_type::decimal, 0, bits};
+}
+
+maybe_key value_key(const value &v)
+{
+	switch (v.t) {
+	case tag::atom:
+		return index_key {key_type::atom, 0, v.id};
+	case tag::str:
+		return index_key {key_type::atom, v.p->n, v.p->id};
+	case tag::integer:
+		return number_key(v.i);
+	case tag::decimal:
+		return number_key(v.d);
+	default:
+		return nullopt;
+	}
+}
+
+void predicate::add(const code *c, const maybe_key &first)
+{
+	all.push_back(c);
+	if (!first) {
+		variable.push_back(c);
+		for (auto &bucket : keyed)
+			bucket.second.push_back(c);
+		return;
+	}
+	auto b = keyed.find(*first);
+	if (b == keyed.end())
+		b = keyed.insert(make_pair(*first, variable)).first;
+	b->second.push_back(c);
+}
+
+const clause_list &predicate::lookup(const maybe_key &first) const
+{
+	if (!first)
+		return all;
+	auto b = keyed.find(*first);
+	if (b == keyed.end())
+		return variable;
+	return b->second;
+}
+
+void clause_index::add(p_code c)
+{
+	if (sharing)
+		ground.share(*c);
+	value head = arg_value(c->head, 0);
+	auto pred = value_key(head);
+	assert(pred);
+	maybe_key first;
+	if (head.t == tag::str)
+		first = value_key(arg_value(head.p + 1, 0));
+	predicates[*pred].add(c.get(), first);
+	clauses.push_back(move(c));
+}
+
+const clause_list &
+clause_index::lookup(const maybe_key &pred, const maybe_key &first) const
+{
+	if (!pred || pred->type != key_type::atom)
+		return none;
+	auto p = predicates.find(*pred);
+	if (p == predicates.end())
+		return none;
+	return p->second.lookup(first);
+}
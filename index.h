@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "cell.h"
+
+namespace {
+	using std::vector;
+	using std::optional;
+	using std::unordered_map;
+	using std::unordered_set;
+}
+
+/*
+ * Clause index. Clauses are grouped by the name/arity of their head and,
+ * within a predicate, by the principal functor or constant of their first
+ * argument. Clauses whose first argument is a variable appear in every
+ * first-argument bucket so each bucket keeps source order.
+ */
+enum class key_type { atom, integer, decimal };
+
+struct index_key {
+	key_type type;
+	size_t   arity;
+	uint64_t value;
+	bool operator==(const index_key &k) const {
+		return type == k.type && arity == k.arity && value == k.value; }
+};
+
+struct index_key_hash {
+	size_t operator()(const index_key &k) const {
+		return std::hash<uint64_t>()(k.value) ^
+		       (k.arity << 3) ^ size_t(k.type);
+	}
+};
+
+using clause_list = vector<const code *>;
+using maybe_key = optional<index_key>;
+
+index_key number_key(int64_t);
+index_key number_key(double);
+maybe_key value_key(const value &);
+
+class predicate {
+private:
+	clause_list all;
+	clause_list variable;
+	unordered_map<index_key, clause_list, index_key_hash> keyed;
+public:
+	void add(const code *, const maybe_key &);
+	const clause_list &lookup(const maybe_key &) const;
+};
+
+class clause_index {
+private:
+	unordered_map<index_key, predicate, index_key_hash> predicates;
+	vector<p_code> clauses;
+	unordered_set<index_key, index_key_hash> tabled;
+	const clause_list none;
+	bool sharing = false;
+	ground_terms ground;
+public:
+	void add(p_code);
+	const clause_list &lookup(const maybe_key &, const maybe_key &) const;
+	void table(const index_key &pred) { tabled.insert(pred); }
+	bool is_tabled(const index_key &pred) const {
+		return !tabled.empty() && tabled.count(pred); }
+	bool has_tabled() const { return !tabled.empty(); }
+	/* hash-cons the ground terms of the clauses added from now on */
+	void share_ground(bool on) { sharing = on; }
+	bool shares_ground() const { return sharing; }
+	const vector<p_code> &all() const { return clauses; }
+	const unordered_set<index_key, index_key_hash> &tables() const {
+		return tabled; }
+};
@@ -3,165 +3,924 @@
  ******************************************************************************/
 
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <deque>
 #include <optional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
 #include "parser.h"
 #include "interpreter.h"
 #include "unification.h"
+#include "index.h"
+#include "cell.h"
+#include "table.h"
 using namespace std;
 
-using clause_iter = vector<p_clause>::const_iterator;
-using term_iter = vector<p_term>::const_iterator;
-class node {
+using term_iter = vector<const cell *>::const_iterator;
+
+/*
+ * Ports of the box model, per predicate: calls, retries on backtracking
+ * and failures. Counted only when asked for, into the map of the thread
+ * running the query, and added to the program's total when it is done.
+ * A call that has exited fails when backtracking goes back past it, so
+ * the machine keeps the calls it has made until that happens.
+ */
+struct ports {
+	uint64_t call, redo, fail;
+};
+using profile_map = unordered_map<index_key, ports, index_key_hash>;
+
+static thread_local profile_map *prof;
+static mutex profile_lock;
+static profile_map profile;
+
+/*
+ * A clause body being executed. The goals that follow it are reached
+ * through parent/ret, so a call in last position hands its caller's
+ * continuation straight to the callee and the caller's frame is dropped.
+ */
+struct frame;
+using p_frame = shared_ptr<const frame>;
+struct frame {
+	term_iter       end;
+	uint64_t        base;
+	size_t          cut;    /* choice stack height a cut here restores */
+	mutable p_frame parent;
+	term_iter       ret;
+	~frame() {
+		/* unlink a deep chain of parents without recursing */
+		p_frame p = move(parent);
+		while (p && p.use_count() == 1)
+			p = move(p->parent);
+	}
+};
+
+/* storage for frames; a search thread keeps its own and frees it on exit */
+struct free_list : vector<void *> {
+	~free_list() {
+		for (auto p : *this)
+			::operator delete(p);
+	}
+};
+
+/* frames come and go on every call: keep their storage on a free list */
+template<typename T>
+struct recycle {
+	using value_type = T;
+	static thread_local free_list pool;
+	recycle() = default;
+	template<typename U> recycle(const recycle<U> &) {}
+	T *allocate(size_t n) {
+		if (n != 1 || pool.empty())
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		T *p = static_cast<T *>(pool.back());
+		pool.pop_back();
+		return p;
+	}
+	void deallocate(T *p, size_t n) {
+		if (n == 1)
+			pool.push_back(p);
+		else
+			::operator delete(p);
+	}
+	template<typename U> bool operator==(const recycle<U> &) const
+	{ return true; }
+	template<typename U> bool operator!=(const recycle<U> &) const
+	{ return false; }
+};
+template<typename T> thread_local free_list recycle<T>::pool;
+
+/* remaining clauses for a call, and the state to retry them from */
+struct choice {
+	const clause_list *candidates;
+	size_t            next;
+	size_t            end;     /* candidates from here on are not ours */
+	size_t            depth;   /* decisions taken before this one */
+	p_frame           fr;
+	term_iter         goal;
+	size_t            trail;
+	heap_mark         heap;
+	uint64_t          top;
+	size_t            calls;   /* open calls, this one's among them */
+};
+
+/*
+ * OR-parallel search. A task is the list of decisions (which candidate
+ * was taken at each call that had several) leading from the query to a
+ * call, and the range of that call's candidates to try. A worker reaches
+ * the call by replaying the decisions on a machine of its own, so only
+ * the clause database is shared, then searches everything below.
+ *
+ * Each worker queues the tasks it splits off; an idle worker takes the
+ * oldest task from another's queue. A busy worker splits off work only
+ * when some worker is idle, and only from a choice point no cut can
+ * reach, so the answers are those a single thread finds. Ordered by
+ * their decisions they also come in the same order.
+ */
+struct task {
+	vector<uint32_t> path;
+	uint32_t         lo, hi;    /* hi == 0: every candidate */
+};
+
+class scheduler {
 private:
-	const vector<p_clause> &clauses;
-	var_lookup       &table;
-	clause_iter      first_clause;
-	term_iter        goal;
-	term_iter        last_child;
-	vector<uint64_t> bound_vars;
-	const uint64_t   base;
-	uint64_t         children_base;
-	uint64_t         &top;
-	vector<node>     children;
-	void expand(vector<uint64_t>);
-	control          flags;
-	void             do_cut();
+	mutex               lock;
+	condition_variable  wake;
+	vector<deque<task>> queues;
+	size_t              idle;
+	bool                done;
+	bool pop(size_t, task &);
 public:
-	node(const vector<p_clause> &_cls, var_lookup &_table,
-	     clause_iter fst, term_iter _goal, uint64_t _base, uint64_t &_top) :
-	     clauses{_cls}, table{_table}, first_clause{fst}, goal{_goal},
-	     base{_base}, children_base{0}, top{_top}, flags{control::none} {}
-	node(const vector<p_clause> &_cls, var_lookup &_table,
-	     clause_iter fst, term_iter _goal,uint64_t _base,uint64_t &_top,
-	     term_iter b, node c):
-	node(_cls, _table, fst, _goal, _base, _top)
-	{ last_child = b; children.push_back(move(c)); }
-	void stop_backtracking() { first_clause = clauses.end(); }
-	bool solve();
-	bool try_unification();
-	control get_flags() { return flags; }
-	optional<unique_ptr<node>> sibling(term_iter end) {
-		term_iter n = goal + 1;
-		if (n == end)
-			return nullopt;
-		return make_unique<node>(clauses, table, clauses.begin(), n,
-		       base, top);
+	atomic<size_t>      hungry;    /* workers waiting for a task */
+	atomic<size_t>      queued;
+	scheduler(size_t n) : queues(n), idle {0}, done {false}, hungry {0},
+	    queued {0} {}
+	bool take(size_t, task &);
+	void give(size_t, task);
+};
+
+struct worker {
+	scheduler        &sched;
+	size_t           self;
+	const task       &job;
+	size_t           pos;       /* decisions of job replayed so far */
+	bool             ranged;    /* job's range still to be taken */
+	vector<uint32_t> path;      /* decisions on the current branch */
+	unsigned         steps;
+	worker(scheduler &s, size_t i, const task &t) : sched {s}, self {i},
+	    job {t}, pos {0}, ranged {t.hi != 0}, steps {0} {}
+	void replay(size_t &i, size_t &end);
+	bool wanted() {
+		return (++ steps & 255) == 0 && sched.hungry > sched.queued; }
+};
+
+/*
+ * A tabled call being evaluated in place of the goal that made it: the
+ * table, what to undo when a round of its clauses is done, and the
+ * registers of the machine to resume once the table is.
+ */
+struct evaluation {
+	answer_table      *t;
+	size_t            trail;
+	heap_mark         heap;
+	size_t            pending;   /* tables waiting before this one began */
+	uint64_t          added;     /* answers kept when the round began */
+	bool              again;     /* resumed an incomplete table */
+	const cell        *root;
+	worker            *w;
+	vector<choice>    choices;
+	p_frame           fr;
+	term_iter         goal;
+	uint64_t          top;
+	size_t            trail0;
+	uint64_t          barrier0;
+	size_t            calls;     /* open calls, the tabled one among them */
+};
+
+class machine {
+private:
+	const clause_index &index;
+	var_lookup        &table;
+	table_store       &tables;
+	const cell        *root;     /* tabled call resolved by its clauses */
+	worker            *w;        /* set when searching in parallel */
+	vector<choice>    choices;
+	p_frame           fr;
+	term_iter         goal;
+	uint64_t          top;
+	size_t            trail0;    /* trail and barrier with no choices */
+	uint64_t          barrier0;
+	bool              started;
+	vector<evaluation> evals;   /* innermost last */
+	vector<maybe_key> calls;    /* when profiling: calls yet to fail */
+	unordered_map<index_key, uint64_t, index_key_hash> held;
+	/* a query with a time limit gives up once the deadline has passed */
+	optional<chrono::steady_clock::time_point> deadline;
+	uint32_t          steps;
+	bool              expired;
+	bool late() {
+		if (!deadline || (++ steps & 1023))
+			return false;
+		expired = chrono::steady_clock::now() > *deadline;
+		return expired;
+	}
+	/* an arithmetic goal's term follows its arith cell */
+	value current() const {
+		const cell *c = *goal;
+		if (c->t == tag::arith)
+			c ++;
+		return table.deref(arg_value(c, fr->base));
 	}
+	void count(uint64_t ports::*) const;
+	void fail_to(size_t);
+	bool call();
+	bool step();
+	bool tabled(const value &);
+	void evaluate(answer_table &);
+	void round();
+	bool finish();
+	void depend(size_t);
+	bool resolve(const clause_list &, size_t, size_t);
+	bool cut_free(const choice &) const;
+	void offer();
+	void enter(const code *, size_t);
+	bool reclaimable(uint64_t);
+	void reset_barrier();
+	void cut(size_t);
+	bool retry();
+	bool backtrack();
+public:
+	machine(const clause_index &_index, var_lookup &_table,
+	    table_store &_tables, const code &query, uint64_t base,
+	    uint64_t _top, worker *_w = nullptr) :
+	    index{_index}, table{_table}, tables{_tables}, root{nullptr}, w{_w},
+	    fr{make_shared<frame>(frame{query.body.end(), base, 0, nullptr, {}})},
+	    goal{query.body.begin()}, top{_top}, trail0{_table.mark()},
+	    barrier0{_table.get_barrier()}, started{false}, steps{0},
+	    expired{false} {}
+	bool run();
+	void set_deadline(chrono::steady_clock::time_point t) { deadline = t; }
+	bool timed_out() const { return expired; }
 };
 
-void node::expand(vector<uint64_t> vars)
+void machine::reset_barrier()
 {
-	bound_vars = move(vars);
-	vector<p_term> &body = (*first_clause)->body;
-	children_base = top;
-	top += (*first_clause)->nvars;
+	table.set_barrier(choices.empty() ? barrier0 : choices.back().top);
+}
 
-	if (!body.empty()) {
-		last_child = body.end();
-		node child {clauses, table, clauses.begin(), body.begin(),
-		children_base, top};
-		children.push_back(move(child));
+void machine::cut(size_t height)
+{
+	if (choices.size() <= height)
+		return;
+	choices.resize(height);
+	table.count.cuts ++;
+	reset_barrier();
+	table.tidy(choices.empty() ? trail0 : choices.back().trail);
+}
+
+/*
+ * The frames above base can go once no choice point was taken after
+ * they were allocated and no older variable refers into them.
+ */
+bool machine::reclaimable(uint64_t base)
+{
+	if (!choices.empty() && choices.back().top > base)
+		return false;
+	return !table.pinned_above(base);
+}
+
+/* the head of c has just been unified with the goal; run its body */
+void machine::enter(const code *c, size_t height)
+{
+	uint64_t base = top;
+	bool last = goal + 1 == fr->end && fr->parent;
+
+	top += c->nvars;
+	if (c->body.empty()) {
+		uint64_t from = last ? fr->base : base;
+		if (reclaimable(from)) {
+			top = from;
+			table.release(top);
+		}
+		goal ++;
+		return;
+	}
+	if (last && reclaimable(fr->base) &&
+	    !table.refers(base, c->nvars, fr->base)) {
+		/* last call: the callee's frame replaces its caller's */
+		table.move(base, fr->base, c->nvars);
+		base = fr->base;
+		top = base + c->nvars;
+		table.release(top);
 	}
-	assert(first_clause != clauses.end());
-	first_clause ++;
+	p_frame parent = last ? fr->parent : fr;
+	term_iter ret  = last ? fr->ret : goal + 1;
+	fr = allocate_shared<frame>(recycle<frame>(), frame{c->body.end(),
+	     base, height, move(parent), ret});
+	goal = c->body.begin();
 }
 
-bool node::try_unification()
+/*
+ * Try candidates from i on. A choice point at index height is kept while
+ * untried candidates remain and is dropped before the last one is tried.
+ */
+bool machine::resolve(const clause_list &candidates, size_t i, size_t height)
 {
-	auto &f = first_clause;
-	uint64_t t = top;
+	value g = current();
+	bool resumed = choices.size() > height;
+	size_t end = resumed ? choices.back().end : SIZE_MAX;
+	bool decision = w && (resumed || candidates.size() > 1);
+	if (decision && !resumed)
+		w->replay(i, end);
+	for (; i < min(end, candidates.size()); i ++) {
+		const code *c = candidates[i];
+		if (i + 1 == min(end, candidates.size())) {
+			if (choices.size() > height) {
+				choices.resize(height);
+				reset_barrier();
+			}
+		} else if (choices.size() > height) {
+			choices.back().next = i + 1;
+		} else {
+			choices.push_back(choice{&candidates, i + 1, end,
+			    w ? w->path.size() : 0, fr, goal, table.mark(),
+			    table.heap.mark(), top, calls.size()});
+			table.count.choicepoints ++;
+			reset_barrier();
+		}
+		table.clear(top, c->nvars);
+		if (table.unify(arg_value(c->head, top), g)) {
+			if (decision)
+				w->path.push_back(i);
+			enter(c, height);
+			return true;
+		}
+		if (choices.size() > height)
+			table.undo(choices.back().trail);
+	}
+	return false;
+}
 
-	if (first_clause == clauses.end())
-		return false;
-	auto u = builtin(*goal, base, table);
-	if (u) {
-		flags = u->first;
-		auto u2 = u->second;
-		if (!u2.empty())
-			bound_vars = move(u2);
-		first_clause = clauses.end();
-		return u->first == control::none || u->first == control::cut;
-	}
-	/* try unification */
-	for (; f != clauses.end(); f ++) {
-		assert(*goal);
-		assert((*f)->head);
-		auto u = unification((*f)->head, *goal, t, base, table);
-		if (u) {
-			expand(move(*u));
+/* the first calls of a task are decided by the path that leads to it */
+void worker::replay(size_t &i, size_t &end)
+{
+	if (pos < job.path.size()) {
+		i = job.path[pos ++];
+		end = i + 1;
+	} else if (ranged) {
+		i = job.lo;
+		end = job.hi;
+		ranged = false;
+	}
+}
+
+/* a goal that is, or may turn out to be, a cut */
+static bool has_cut(term_iter i, term_iter end)
+{
+	static const uint64_t cut = atom_id.get_id("!");
+	for (; i != end; i ++)
+		if ((*i)->t == tag::var ||
+		    ((*i)->t == tag::atom && (*i)->id == cut))
 			return true;
+	return false;
+}
+
+/*
+ * A cut removes the choice points taken since its clause was called: cp
+ * can only be cut from the bodies of its candidates or from the goals
+ * still to run when it was taken.
+ */
+bool machine::cut_free(const choice &cp) const
+{
+	for (auto c : *cp.candidates)
+		if (has_cut(c->body.begin(), c->body.end()))
+			return false;
+	if (has_cut(cp.goal + 1, cp.fr->end))
+		return false;
+	for (const frame *f = cp.fr.get(); f->parent; f = f->parent.get())
+		if (has_cut(f->ret, f->parent->end))
+			return false;
+	return true;
+}
+
+/* hand the later half of the oldest choice point we can to the scheduler */
+void machine::offer()
+{
+	for (auto &cp : choices) {
+		size_t last = min(cp.end, cp.candidates->size());
+		if (cp.next >= last || !cut_free(cp))
+			continue;
+		size_t mid = cp.next + (last - cp.next) / 2;
+		vector<uint32_t> path(w->path.begin(),
+		                      w->path.begin() + cp.depth);
+		w->sched.give(w->self, task{move(path), uint32_t(mid),
+		                            uint32_t(last)});
+		cp.end = mid;
+		return;
+	}
+}
+
+/* a port of the goal about to be retried */
+void machine::count(uint64_t ports::*port) const
+{
+	maybe_key pred = value_key(current());
+	if (pred)
+		(*prof)[*pred].*port += 1;
+}
+
+/* the open calls from n on fail; from 0, so do those held */
+void machine::fail_to(size_t n)
+{
+	for (size_t i = n; i < calls.size(); i ++)
+		if (calls[i])
+			(*prof)[*calls[i]].fail += 1;
+	if (n < calls.size())
+		calls.resize(n);
+	if (n > 0)
+		return;
+	for (auto &i : held)
+		(*prof)[i.first].fail += i.second;
+	held.clear();
+}
+
+bool machine::call()
+{
+	table.count.inferences ++;
+	if (!prof)
+		return step();
+	/* with no choice point the open calls can only fail together */
+	if (calls.size() >= 4096 && choices.empty() && evals.empty()) {
+		for (auto &k : calls)
+			if (k)
+				held[*k] ++;
+		calls.clear();
+	}
+	maybe_key pred = value_key(current());
+	if (pred)
+		(*prof)[*pred].call += 1;
+	calls.push_back(pred);
+	if (step())
+		return true;
+	fail_to(calls.size() - 1);
+	return false;
+}
+
+bool machine::step()
+{
+	control u;
+	if (w && w->wanted())
+		offer();
+	if ((*goal)->t == tag::arith) {
+		u = run_arith(*goal, fr->base, table);
+	} else {
+		value g = current();
+		maybe_key pred = value_key(g), first;
+		if (!pred || pred->type != key_type::atom)
+			return false;
+		builtin_fn b = find_builtin(*pred);
+		if (!b && *goal != root && index.is_tabled(*pred))
+			return tabled(g);
+		if (!b) {
+			if (g.t == tag::str)
+				first = value_key(table.arg(g, 1));
+			return resolve(index.lookup(pred, first), 0,
+			    choices.size());
+		}
+		u = b(g, table);
+	}
+	if (u == control::fail)
+		return false;
+	if (u == control::cut)
+		cut(fr->cut);
+	if (goal + 1 == fr->end && fr->parent && reclaimable(fr->base)) {
+		top = fr->base;
+		table.release(top);
+	}
+	goal ++;
+	return true;
+}
+
+/*
+ * Answer a call to a tabled predicate from the table of its variant. A
+ * table that needs evaluating first is evaluated by this machine, and the
+ * call is answered when that is done.
+ */
+bool machine::tabled(const value &g)
+{
+	answer_table &t = tables.find(g, table);
+	switch (t.state) {
+	case table_state::fresh:
+	case table_state::incomplete:
+		evaluate(t);
+		return true;
+	case table_state::evaluating:
+		depend(t.depth);
+		break;
+	default:
+		break;
+	}
+	return resolve(t.answers, 0, choices.size());
+}
+
+/* everything evaluated since depth reads a table that may still grow */
+void machine::depend(size_t depth)
+{
+	for (size_t i = depth; i < tables.stack.size(); i ++) {
+		answer_table *t = tables.stack[i];
+		t->recursive = true;
+		t->low = min(t->low, depth);
+	}
+}
+
+/*
+ * Run the clauses of t's variant to exhaustion, above everything the
+ * current goal uses, and keep the answers. The machine puts its registers
+ * aside and runs the variant as a query of its own, so a tabled call
+ * inside it nests another evaluation rather than a call on the C++ stack.
+ * The run is repeated while it read a table under evaluation and found
+ * something new. The oldest evaluation it depended on completes it: until
+ * then it is left incomplete and evaluated again when next called.
+ */
+void machine::evaluate(answer_table &t)
+{
+	bool again = t.state == table_state::incomplete;
+
+	/* an incomplete table still waits on the same evaluation below */
+	t.state = table_state::evaluating;
+	t.depth = tables.stack.size();
+	if (!again)
+		t.low = t.depth;
+	tables.stack.push_back(&t);
+	evals.push_back(evaluation {&t, table.mark(), table.heap.mark(),
+	    tables.pending.size(), 0, again, root, w, move(choices), fr, goal,
+	    top, trail0, barrier0, calls.size()});
+	round();
+}
+
+/* start a round of the innermost evaluation's clauses */
+void machine::round()
+{
+	evaluation &e = evals.back();
+	const code &call = *e.t->call;
+
+	e.t->recursive = false;
+	e.added = tables.added;
+	table.clear(e.top, call.nvars);
+	root = call.body.back();
+	w = nullptr;
+	choices.clear();
+	fr = make_shared<frame>(frame{call.body.end(), e.top, 0, nullptr, {}});
+	goal = call.body.begin();
+	top = e.top + call.nvars;
+	trail0 = table.mark();
+	barrier0 = table.get_barrier();
+}
+
+/*
+ * The innermost evaluation's round has run out. Start another, or put
+ * its caller back and answer the call; false if that fails.
+ */
+bool machine::finish()
+{
+	evaluation &e = evals.back();
+	answer_table &t = *e.t;
+
+	table.undo(e.trail);
+	table.heap.reset(e.heap);
+	table.release(e.top);
+	table.set_barrier(e.choices.empty() ? e.barrier0 : e.choices.back().top);
+	if (t.recursive && tables.added != e.added) {
+		round();
+		return true;
+	}
+	tables.stack.pop_back();
+	if (t.low < t.depth) {
+		t.state = table_state::incomplete;
+		if (!e.again)
+			tables.pending.push_back(&t);
+	} else {
+		t.state = table_state::complete;
+		for (size_t i = e.pending; i < tables.pending.size(); i ++)
+			tables.pending[i]->state = table_state::complete;
+		tables.pending.resize(e.pending);
+	}
+	root = e.root;
+	w = e.w;
+	choices = move(e.choices);
+	fr = move(e.fr);
+	goal = e.goal;
+	top = e.top;
+	trail0 = e.trail0;
+	barrier0 = e.barrier0;
+	size_t open = e.calls;
+	evals.pop_back();
+	if (resolve(t.answers, 0, choices.size()))
+		return true;
+	if (prof)
+		fail_to(open - 1);
+	return false;
+}
+
+/* resume the newest choice point that has a candidate left */
+bool machine::retry()
+{
+	while (!choices.empty()) {
+		choice &cp = choices.back();
+		table.undo(cp.trail);
+		table.heap.reset(cp.heap);
+		top = cp.top;
+		table.release(top);
+		fr = cp.fr;
+		goal = cp.goal;
+		if (w)
+			w->path.resize(cp.depth);
+		if (prof)
+			fail_to(cp.calls);
+		if (cp.next >= min(cp.end, cp.candidates->size())) {
+			/* the rest went to other workers */
+			choices.pop_back();
+			reset_barrier();
+			continue;
 		}
+		table.count.backtracks ++;
+		size_t open = cp.calls;
+		if (prof)
+			count(&ports::redo);
+		if (resolve(*cp.candidates, cp.next, choices.size() - 1))
+			return true;
+		if (prof)
+			fail_to(open - 1);
 	}
+	/* out of choices: every call still open fails */
+	if (prof)
+		fail_to(evals.empty() ? 0 : evals.back().calls);
 	return false;
 }
 
-void node::do_cut()
+/* when an evaluation runs out of choices, its caller goes on backtracking */
+bool machine::backtrack()
 {
-	for (auto &child: children)
-		child.stop_backtracking();
-	stop_backtracking();
+	while (!retry()) {
+		if (evals.empty())
+			return false;
+		if (finish())
+			return true;
+	}
+	return true;
 }
 
-bool node::solve()
+/* find the next solution of the query */
+bool machine::run()
 {
+	if (started && !backtrack())
+		return false;
+	started = true;
 	while (true) {
-		if (children.empty()) {
-			remove_from_table(table, bound_vars);
-			if (!try_unification())
-				return false;
-			else if (children.empty())
+		if (goal == fr->end && fr->parent) {
+			goal = fr->ret;
+			fr = fr->parent;
+		} else if (goal == fr->end) {
+			if (evals.empty())
 				return true;
-		} // fall through
-
-		while (!children.empty()) {
-			node &last = children.back();
-			if (last.solve()) {
-				if (last.flags == control::cut)
-					do_cut();
-				optional<unique_ptr<node>> next;
-				if ((next = last.sibling(last_child)))
-					children.push_back(move(**next));
-				else
-					return true;
-			} else
-				children.pop_back();
+			/* an answer of the innermost evaluation: keep it, go on */
+			evaluation &e = evals.back();
+			if (e.t->add(copy_term(arg_value(root, e.top), table)))
+				tables.added ++;
+			if (!backtrack())
+				return false;
+		} else if (late() || (!call() && !backtrack()))
+			return false;
+	}
+}
+
+/* own tasks newest first; otherwise steal another worker's oldest */
+bool scheduler::pop(size_t self, task &t)
+{
+	for (size_t k = 0; k < queues.size(); k ++) {
+		auto &q = queues[(self + k) % queues.size()];
+		if (q.empty())
+			continue;
+		if (k == 0) {
+			t = move(q.back());
+			q.pop_back();
+		} else {
+			t = move(q.front());
+			q.pop_front();
 		}
+		queued --;
+		return true;
 	}
+	return false;
+}
+
+/* wait for a task; there is none left once every worker waits */
+bool scheduler::take(size_t self, task &t)
+{
+	unique_lock<mutex> l {lock};
+	while (!done) {
+		if (pop(self, t))
+			return true;
+		if (idle + 1 == queues.size()) {
+			done = true;
+			wake.notify_all();
+			break;
+		}
+		idle ++;
+		hungry ++;
+		wake.wait(l);
+		hungry --;
+		idle --;
+	}
+	return false;
+}
+
+void scheduler::give(size_t self, task t)
+{
+	lock_guard<mutex> l {lock};
+	queues[self].push_back(move(t));
+	queued ++;
+	wake.notify_one();
 }
 
-bool
-solve(const vector<p_clause> &clauses, const vector<p_term> &query, uint64_t max_id)
+/* a query variable, printed from the variable so a cycle shows as X */
+static value query_var(uint64_t id)
+{
+	value v;
+	v.t = tag::ref;
+	v.id = id;
+	return v;
+}
+
+static void print_answer(ostream &os, const var_lookup &table,
+    const unordered_map<uint64_t, string> &var_map)
+{
+	for (auto &i : var_map) {
+		if (!table.find(i.first))
+			continue;
+		os << i.second << "=>" << bind_env{query_var(i.first), table,
+		                                   &var_map} << '\n';
+	}
+	if (var_map.empty()) os << "yes" << '\n';
+}
+
+using answer = pair<vector<uint32_t>, string>;
+
+static void add_profile(const profile_map &m)
+{
+	lock_guard<mutex> l {profile_lock};
+	for (auto &i : m) {
+		ports &p = profile[i.first];
+		p.call += i.second.call;
+		p.redo += i.second.redo;
+		p.fail += i.second.fail;
+	}
+}
+
+/* the profile of every query so far, busiest predicates first */
+void print_profile(ostream &os)
+{
+	lock_guard<mutex> l {profile_lock};
+	vector<pair<index_key, ports>> preds(profile.begin(), profile.end());
+	sort(preds.begin(), preds.end(), [](auto &a, auto &b) {
+		return a.second.call > b.second.call; });
+	os << "% " << left << setw(20) << "predicate" << right
+	   << setw(11) << "calls" << setw(11) << "redos" << setw(11)
+	   << "fails" << endl;
+	for (auto &p : preds) {
+		ostringstream name;
+		name << atom_id.get_name(p.first.value) << "/" << p.first.arity;
+		os << "% " << left << setw(20) << name.str() << right
+		   << setw(11) << p.second.call << setw(11) << p.second.redo
+		   << setw(11) << p.second.fail << endl;
+	}
+}
+
+static void search(const clause_index &index, const code &query,
+    uint64_t base, uint64_t top, const unordered_map<uint64_t, string> &names,
+    scheduler &sched, size_t self, vector<answer> &found, bool profiled)
+{
+	profile_map local;
+	task t;
+	prof = profiled ? &local : nullptr;
+	while (sched.take(self, t)) {
+		var_lookup table;
+		table_store tables;
+		worker w {sched, self, t};
+		machine engine {index, table, tables, query, base, top, &w};
+		while (engine.run()) {
+			ostringstream os;
+			print_answer(os, table, names);
+			found.emplace_back(w.path, os.str());
+		}
+		table.retire();
+	}
+	add_profile(local);
+}
+
+/* every answer, found by opts.workers threads */
+static bool search(const clause_index &index, const code &query,
+    uint64_t base, uint64_t top, const unordered_map<uint64_t, string> &names,
+    const search_opts &opts)
+{
+	scheduler sched {opts.workers};
+	vector<vector<answer>> found(opts.workers);
+	vector<thread> threads;
+	vector<answer> all;
+
+	sched.give(0, task{{}, 0, 0});
+	for (size_t i = 0; i < opts.workers; i ++)
+		threads.emplace_back([&, i] { search(index, query, base, top,
+		    names, sched, i, found[i], opts.profile); });
+	for (auto &t : threads)
+		t.join();
+	for (auto &f : found)
+		move(f.begin(), f.end(), back_inserter(all));
+	if (opts.ordered)
+		sort(all.begin(), all.end());
+	for (auto &a : all)
+		cout << a.second;
+	return !all.empty();
+}
+
+bool solve(const clause_index &index, const vector<p_term> &query,
+    uint64_t max_id, const search_opts &opts)
 {
 	unordered_map<uint64_t, string> var_map;
 	var_lookup table;
-	uint64_t id = max_id + 1, top = id, m;
+	uint64_t id = max_id + 1, top;
 	bool solved = false;
+	profile_map local;
+	counters before = table.lifetime();
+	auto start = chrono::steady_clock::now();
 
 	assert(!query.empty());
-	for (auto &q : query) {
+	for (auto &q : query)
 		scan_vars(q, id, var_map);
-		m = find_max_ids(q);
-		if (m > top)
-			top = m;
-	}
-	top = top + id;
-
-	node child {clauses, table, clauses.begin(), query.begin(), id, top};
-	node root  {clauses, table, clauses.end(),   query.begin(), id, top,
-	    query.end(), move(child)};
-	while (root.solve()) {
-		solved = true;
-		for (auto &i : var_map) {
-			auto n = table.find(i.first);
-			if (n == table.end())
-				continue;
-			cout << i.second << "=>" << bind_env{n->second, table}
-			     << endl;
+	p_code code = compile(nullptr, query);
+	top = id + code->nvars;
+
+	/* tables are built in the order calls are made: keep to one thread */
+	if (opts.workers > 1 && !index.has_tabled()) {
+		solved = search(index, *code, id, top, var_map, opts);
+	} else {
+		table_store tables;
+		machine engine {index, table, tables, *code, id, top};
+		prof = opts.profile ? &local : nullptr;
+		while (engine.run()) {
+			solved = true;
+			print_answer(cout, table, var_map);
 		}
-		if (var_map.empty()) cout << "yes" << endl;
+		prof = nullptr;
+		add_profile(local);
 	}
 	if (!solved) cout << "no";
-	cout << endl;
+	/* one flush per query, so a terminal still sees each answer set */
+	cout << '\n' << flush;
+	table.retire();
+	if (opts.timing) {
+		chrono::duration<double, milli> ms =
+		    chrono::steady_clock::now() - start;
+		uint64_t n = table.lifetime().inferences - before.inferences;
+		cerr << "% " << n << " inferences, " << fixed
+		     << setprecision(3) << ms.count() << " ms, "
+		     << setprecision(0) << (ms.count() > 0 ? n * 1000 /
+		        ms.count() : 0) << " LIPS" << defaultfloat << endl;
+	}
 	return solved;
 }
+
+query_end each_answer(const clause_index &index, const vector<p_term> &query,
+    uint64_t max_id, const query_limits &limits, bool profile,
+    const answer_fn &answer)
+{
+	unordered_map<uint64_t, string> var_map;
+	var_lookup table;
+	table_store tables;
+	profile_map local;
+	uint64_t id = max_id + 1, found = 0;
+	query_end end = query_end::exhausted;
+
+	for (auto &q : query)
+		scan_vars(q, id, var_map);
+	vector<pair<uint64_t, string>> names(var_map.begin(), var_map.end());
+	sort(names.begin(), names.end());
+	p_code code = compile(nullptr, query);
+	machine engine {index, table, tables, *code, id, id + code->nvars};
+	if (limits.timeout.count())
+		engine.set_deadline(chrono::steady_clock::now() +
+		    limits.timeout);
+
+	binding_list bindings;
+	ostringstream os;
+	prof = profile ? &local : nullptr;
+	while (engine.run()) {
+		bindings.clear();
+		for (auto &n : names) {
+			if (!table.find(n.first))
+				continue;
+			os.str("");
+			os << bind_env{query_var(n.first), table, &var_map};
+			bindings.emplace_back(n.second, os.str());
+		}
+		if (!answer(bindings)) {
+			end = query_end::stopped;
+			break;
+		}
+		if (++ found == limits.answers) {
+			end = query_end::limit;
+			break;
+		}
+	}
+	prof = nullptr;
+	add_profile(local);
+	if (engine.timed_out())
+		end = query_end::timeout;
+	table.retire();
+	return end;
+}
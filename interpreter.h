@@ -1,4 +1,46 @@
 #pragma once
 #include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <functional>
 #include "parser.h"
-bool solve(const std::vector<p_clause> &, const std::vector<p_term> &, uint64_t);
+#include "index.h"
+
+/* how queries are searched: with workers > 1, by that many threads */
+struct search_opts {
+	unsigned workers = 1;
+	bool     ordered = true;    /* answers in the order one thread finds them */
+	bool     timing = false;    /* inferences and time of each query */
+	bool     profile = false;   /* count the ports of every predicate */
+};
+
+bool solve(const clause_index &, const std::vector<p_term> &, uint64_t,
+    const search_opts &);
+void print_profile(std::ostream &);
+
+/* how many answers of one query to find, and for how long: 0 for no limit */
+struct query_limits {
+	uint64_t                  answers = 0;
+	std::chrono::milliseconds timeout {0};
+};
+
+enum class query_end { exhausted, limit, timeout, stopped };
+
+/*
+ * Answers one at a time: the named variables of the query, in order of
+ * first occurrence, with their values printed. Returning false stops.
+ * With profile set the query's ports are counted, as solve() does.
+ */
+using binding_list = std::vector<std::pair<std::string, std::string>>;
+using answer_fn = std::function<bool(const binding_list &)>;
+
+query_end each_answer(const clause_index &, const std::vector<p_term> &,
+    uint64_t, const query_limits &, bool profile, const answer_fn &);
+
+/* serving queries: on standard input, or on a local socket if named */
+struct serve_opts {
+	bool         enabled = false;
+	std::string  socket;
+	query_limits limits;
+};
@@ -5,21 +5,103 @@
  *
  *****************************************************************************/
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <cctype>
+#include <thread>
+#include <string>
 #include "parser.h"
+#include "interpreter.h"
 
 using namespace std;
 
+/*
+ * usage: prolog [-j workers] [-u] [-s] [-p] [-c image]
+ *               [-S | -U socket] [-n answers] [-t ms] file...
+ *   -j n  search each query with n threads (0: one per core)
+ *   -u    parallel answers in no particular order, not sequential order
+ *   -s    print the inferences and time of each query on stderr
+ *   -p    print calls, redos and fails of each predicate on exit
+ *   -c f  save the loaded program as an image in f instead of reading
+ *         queries from the terminal; an image is loaded like any file
+ *   -S    serve queries on standard input once the files are loaded
+ *   -U p  serve queries on connections to the local socket p
+ *   -n n  when serving, stop each query after n answers
+ *   -t ms when serving, stop each query after ms milliseconds
+ */
+static void usage()
+{
+	cerr << "usage: prolog [-j workers] [-u] [-s] [-p] [-c image]" << endl
+	     << "              [-S | -U socket] [-n answers] [-t ms] file..."
+	     << endl;
+}
+
 int main(int argc, char **argv)
 {
 	vector<istream *> ios;
+	search_opts search;
+	string image;
+	serve_opts server;
 	for (int i = 1; i < argc; i ++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			const char *arg = argv[++ i];
+			char *end;
+			errno = 0;
+			long n = strtol(arg, &end, 10);
+			if (!isdigit(*arg) || *end || errno || n > UINT_MAX) {
+				usage();
+				return 2;
+			}
+			/* hardware_concurrency() may not know, and say 0 */
+			search.workers = n > 0 ? n :
+			    max(1u, thread::hardware_concurrency());
+			continue;
+		}
+		if (!strcmp(argv[i], "-u")) {
+			search.ordered = false;
+			continue;
+		}
+		if (!strcmp(argv[i], "-s")) {
+			search.timing = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "-p")) {
+			search.profile = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			image = argv[++ i];
+			continue;
+		}
+		if (!strcmp(argv[i], "-S")) {
+			server.enabled = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "-U") && i + 1 < argc) {
+			server.enabled = true;
+			server.socket = argv[++ i];
+			continue;
+		}
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			server.limits.answers = atoll(argv[++ i]);
+			continue;
+		}
+		if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			server.limits.timeout =
+			    chrono::milliseconds(atoll(argv[++ i]));
+			continue;
+		}
 		ifstream *fs = new ifstream();
 	       	fs->open(argv[i], fstream::in); 
 		ios.push_back(fs);
 	}
-	ios.push_back(&cin);
+	if (image.empty() && !server.enabled)
+		ios.push_back(&cin);
 	reverse(ios.begin(), ios.end());
-	return program(ios) ? 0 : 1;
+	return program(ios, search, image, server) ? 0 : 1;
 }
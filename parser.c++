@@ -3,13 +3,29 @@
 #include <optional>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <thread>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <cmath>
 #include "parser.h"
 #include "interpreter.h"
+#include "cell.h"
+#include "unification.h"
+#include "image.h"
+#include "server.h"
 
 using namespace std;
 
 unique_id atom_id;
-unique_id var_id;
+thread_local unique_id var_id;
+
+/* where the parser interns atoms; a loader thread keeps its own table */
+static thread_local unique_id *atoms = &atom_id;
 
 class syntax_error : public exception {
 private:
@@ -39,6 +55,7 @@ private:
 public:
 	op_t(const assoc_t a, int p) : assoc {a}, pred {p} {}
 	int  get_pred()  const { return pred;  }
+	assoc_t get_assoc() const { return assoc; }
 	bool unary() const { return assoc == assoc_t::fx ||
 	assoc == assoc_t::fy || assoc == assoc_t::xf || assoc == assoc_t::yf;}
 	bool binary() const { return !unary() && !null(); }
@@ -77,6 +94,7 @@ public:
 		return dummy;
 	}
 	int lowest() { return *pred_set.begin(); }
+	const auto &all() const { return operators; }
 	optional<int> higher(int last) {
 		auto m = pred_set.upper_bound(last);
 		if (m == pred_set.end())
@@ -91,37 +109,6 @@ public:
 	}
 };
 
-struct token_parser_entry {
-	regex pat;
-	symbol sym;
-} token_parser_table[] = {
-	{regex("^[[:space:]]+"),                symbol::ignore  },
-	{regex("^%.*$"),                        symbol::ignore  },
-	{regex(R"(^/\*[\S\s]*?\*/)"),           symbol::ignore  },
-	{regex(R"(^/\*.*)"),                    symbol::append  },
-	{regex(R"(^'(\\.|[^'])*')"),            symbol::string  },
-	{regex(R"(^'.*)"),                      symbol::append  },
-	{regex("^,"),                           symbol::comma   },
-	{regex("^\\|"),                         symbol::vbar    },
-	{regex(R"(^\[\])"),                     symbol::atom    },
-	{regex("^!"),                           symbol::cut     },
-	{regex("^\\["),                         symbol::lbracket},
-	{regex("^\\]"),                         symbol::rbracket},
-	{regex("^\\("),                         symbol::lparen  },
-	{regex("^\\)"),                         symbol::rparen  },
-	{regex("^[\\-]?[[:digit:]]+\\.[[:digit:]]+"), symbol::decimal },
-	{regex("^[\\-]?[[:digit:]]+"),          symbol::integer },
-	{regex("^[[:lower:]][[:alnum:]_]*"),    symbol::atom    },
-	{regex("^\\?-"),                        symbol::query   },
-	{regex("^:-"),                          symbol::rules   },
-	{regex("^[#$&*\\+-./:<=>?@^~\\\\]+"),   symbol::atom    },
-	{regex("^[_$[:upper:]][_$[:alnum:]]*"), symbol::variable},
-	{regex("^."),                           symbol::error   }
-};
-
-template <typename T, size_t N> T* table_begin(T(&arr)[N]) { return &arr[0];   }
-template <typename T, size_t N> T* table_end(T(&arr)[N])   { return &arr[0]+N; }
-
 string conv2escape(string text)
 {
 	string r;
@@ -135,23 +122,118 @@ string conv2escape(string text)
 	return r;
 }
 
-unique_ptr<token>
-parse_token(const string::iterator begin, const string::iterator end)
+/*
+ * The scanner. Tokens are recognised in the order below; the first rule
+ * that matches wins, not the longest. A comment or quoted atom that runs
+ * to the end of the buffer comes back as symbol::append so the caller can
+ * read more input and scan again; so does a number when the buffer may go
+ * on (partial) and ends before it is known whether a fraction or an
+ * exponent follows.
+ */
+static bool symbol_char(char c)
+{
+	return c && strchr("#$&*+,-./:<=>?@^~\\", c);
+}
+
+static bool space(char c) { return isspace((unsigned char)c); }
+static bool digit(char c) { return isdigit((unsigned char)c); }
+static bool alnum(char c) { return isalnum((unsigned char)c); }
+
+static size_t run(const char *p, const char *end, bool (*f)(char))
 {
-	auto t = make_unique<token>(symbol::error);
+	const char *q = p;
+	while (q != end && f(*q))
+		q ++;
+	return q - p;
+}
 
-	for (auto entry = table_begin(token_parser_table);
-	          entry != table_end(token_parser_table); entry ++) {
-		if (t->match(begin, end, entry->pat, entry->sym))
-			break;
+static pair<symbol, size_t> scan(const char *p, const char *end,
+    bool partial = false)
+{
+	const char *q;
+	char c = *p, n = p + 1 != end ? p[1] : 0;
+
+	if (space(c))
+		return {symbol::ignore, run(p, end, space)};
+	if (c == '%') {
+		q = static_cast<const char *>(memchr(p, '\n', end - p));
+		return {symbol::ignore, (q ? q : end) - p};
 	}
-	return t;
+	if (c == '/' && n == '*') {
+		for (q = p + 2; q + 1 < end; q ++)
+			if (q[0] == '*' && q[1] == '/')
+				return {symbol::ignore, q + 2 - p};
+		return {symbol::append, end - p};
+	}
+	if (c == '\'') {
+		for (q = p + 1; q < end; q ++) {
+			if (*q == '\\')
+				q ++;
+			else if (*q == '\'')
+				return {symbol::string, q + 1 - p};
+		}
+		return {symbol::append, end - p};
+	}
+	switch (c) {
+	case ',': return {symbol::comma, 1};
+	case '|': return {symbol::vbar, 1};
+	case '!': return {symbol::cut, 1};
+	case '[': return {n == ']' ? symbol::atom : symbol::lbracket,
+	                  n == ']' ? 2u : 1u};
+	case ']': return {symbol::rbracket, 1};
+	case '(': return {symbol::lparen, 1};
+	case ')': return {symbol::rparen, 1};
+	}
+	if (digit(c) || (c == '-' && digit(n))) {
+		q = p + 1;
+		q += run(q, end, digit);
+		if (partial && (q == end || (q + 1 == end && *q == '.')))
+			return {symbol::append, end - p};
+		if (q + 1 < end && *q == '.' && digit(q[1])) {
+			q ++;
+			q += run(q, end, digit);
+			/* an exponent: 1.5e10, 1.0e+20, 2.5E-3 */
+			const char *e = q;
+			if (e != end && (*e == 'e' || *e == 'E')) {
+				e ++;
+				if (e != end && (*e == '+' || *e == '-'))
+					e ++;
+				if (e != end && digit(*e))
+					q = e + run(e, end, digit);
+			}
+			if (partial && e == end)
+				return {symbol::append, end - p};
+			return {symbol::decimal, q - p};
+		}
+		return {symbol::integer, q - p};
+	}
+	if (islower((unsigned char)c))
+		return {symbol::atom, 1 + run(p + 1, end,
+		        [](char c) { return alnum(c) || c == '_'; })};
+	if (c == '?' && n == '-')
+		return {symbol::query, 2};
+	if (c == ':' && n == '-')
+		return {symbol::rules, 2};
+	if (symbol_char(c))
+		return {symbol::atom, run(p, end, symbol_char)};
+	if (c == '_' || isupper((unsigned char)c))
+		return {symbol::variable, 1 + run(p + 1, end,
+		        [](char c) { return alnum(c) || c == '_' || c == '$'; })};
+	return {symbol::error, 1};
 }
 
+/*
+ * Input is read in large blocks, or a line at a time from an interactive
+ * stream so a query can be answered before the next one is typed.
+ */
 class interp_context {
 	using transformer_t = unique_ptr<token> (*)(std::unique_ptr<token>);
 private:
+	static const size_t block = 1 << 16;
+	static const size_t lookahead = 4;   /* enough to tell 1. from 1.5 */
 	vector<istream *> ins;
+	bool lines;
+	bool more;
 	string str;
 	size_t offset;
 	vector<unique_ptr<token>> token_stack;
@@ -164,69 +246,114 @@ private:
 		token_stack.pop_back();
 		return x;
 	}
+	bool refill();
 	position_t position;
 public:
-	interp_context() {}
-	interp_context(vector<istream *>is):ins{is}, offset{0}, position{0,0} {}
-	void push_input_stream(istream *i) { ins.push_back(i); }
+	interp_context() : lines{false}, more{false}, offset{0}, position{1,1} {}
+	interp_context(const operator_t &o) :
+		lines{false}, more{false}, offset{0}, position{1,1}, ops{o} {}
+	interp_context(vector<istream *>is) : interp_context() {
+		ins = is;
+		next_stream();
+	}
+	void next_stream() {
+		more = !ins.empty();
+		lines = more && (ins.back() == &cin || interactive);
+	}
+	/* read i once the streams already pushed are done */
+	void push_input_stream(istream *i) {
+		ins.insert(ins.begin(), i);
+		if (ins.size() == 1)
+			next_stream();
+	}
 	unique_ptr<token> get_token();
 	void ins_transformer(transformer_t t) { transformers.insert(t); }
 	void rmv_transformer(transformer_t t) { transformers.erase(t);  }
 	void push(unique_ptr<token> &t) { token_stack.push_back(move(t)); }
 	const position_t & get_position() const { return position; }
 	operator_t ops;
+	clause_index *db = nullptr;   /* where directives declare things */
+	search_opts search;
+	bool parallel = false;        /* search set by a parallel directive */
+	bool interactive = false;     /* every stream read a line at a time */
 };
 
+/* append the next block or line of the current stream to str */
+bool interp_context::refill()
+{
+	istream &in = *ins.back();
+	str.erase(0, offset);
+	offset = 0;
+	if (lines) {
+		string line;
+		if ((more = bool(getline(in, line))))
+			str += line + '\n';
+		return more;
+	}
+	size_t n = str.size();
+	str.resize(n + block);
+	in.read(&str[n], block);
+	str.resize(n + in.gcount());
+	more = in.gcount() == block;
+	return in.gcount() > 0;
+}
+
 unique_ptr<token> interp_context::_get_token()
 {
 	unique_ptr<token> next;
-	position_t token_position;
+	pair<symbol, size_t> s;
+	bool spaced = false;
 
 	if ((next = pop()) != nullptr)
 		return next;
 
-	next = make_unique<token>(symbol::none);
 	do {
-		while (str.begin() + offset == str.end() &&
-		       next->get_type() != symbol::eof) {
-			while (true) {
-				if (ins.empty()) {
-					next = make_unique<token>(symbol::eof);
-					break;
-				} else if (getline(*(ins.back()), str))
-					break;
-				else {
-					position.first = 0;
-					ins.pop_back();
-				}
+		while (true) {
+			if (ins.empty()) {
+				next = make_unique<token>(symbol::eof);
+				next->set_position(position);
+				return next;
 			}
-			offset = 0;
-			position.first ++;
-			position.second = 1;
-		}
-		token_position = position;
-		if (next->get_type() != symbol::eof) {
-			next = parse_token(str.begin() + offset, str.end());
-			while (next->get_type() == symbol::append) {
-				string line_continue;
-				if (!getline(*(ins.back()), line_continue))
-					next->set_type(symbol::error);
-				else {
-					str += '\n' + line_continue;
-					position.first ++;
-					position.second = 1;
-					next = parse_token(
-					       str.begin() + offset, str.end());
-				}
+			size_t avail = str.size() - offset;
+			if (more && avail < (lines ? 1 : lookahead) &&
+			    refill())
+				continue;
+			if (avail == 0) {
+				ins.pop_back();
+				str.clear();
+				offset = 0;
+				next_stream();
+				position = {1, 1};
+				continue;
+			}
+			const char *p = str.data() + offset;
+			s = scan(p, str.data() + str.size(), more);
+			/* a token running into the end may go on in the input */
+			if (more && (s.first == symbol::append ||
+			    s.second == avail)) {
+				refill();
+				continue;
 			}
-			auto length = next->get_text().length();
-			offset += length;
-			position.second += length;
+			break;
+		}
+		if (s.first == symbol::append)
+			s.first = symbol::error;
+		next = make_unique<token>(s.first);
+		next->set_text(str.substr(offset, s.second));
+		next->set_position(position);
+		next->set_spaced(spaced);
+		spaced = s.first == symbol::ignore;
+		for (size_t i = offset; i < offset + s.second; i ++) {
+			if (str[i] == '\n') {
+				position.first ++;
+				position.second = 1;
+			} else
+				position.second ++;
 		}
+		offset += s.second;
 	} while (next->get_type() == symbol::ignore);
-	next->set_position(token_position);
 
-	return (next);
+	return next;
 }
 
 unique_ptr<token> interp_context::get_token()
@@ -352,6 +479,16 @@ optional<p_term> external_parse_term(string stream)
 	return parse_expression(context);
 }
 
+static p_term atom_term(const string &name, vector<p_term> args = {})
+{
+	auto n = make_unique<token>(symbol::atom);
+	n->set_text(name);
+	n->id = atoms->get_id(name);
+	if (args.empty())
+		return make_unique<term>(move(n));
+	return make_unique<term>(move(n), move(args));
+}
+
 optional<p_term> parse_exp_next(interp_context &context, int priority)
 {
 	auto new_prio = context.ops.higher(priority);
@@ -362,8 +499,18 @@ optional<p_term> parse_exp_next(interp_context &context, int priority)
 		unique_ptr<token> t;
 
 		t = context.get_token();
+		/* (a, b, c) is ','(a, ','(b, c)) */
 		if (t->get_type() == symbol::lparen) {
-			r = parse_expression(context);
+			auto v = many(context, parse_expression, symbol::comma);
+			if (v.empty())
+				throw syntax_error(*t, "term expected");
+			r = move(v.back());
+			for (size_t i = v.size() - 1; i -- > 0; ) {
+				vector<p_term> args;
+				args.push_back(move(v[i]));
+				args.push_back(move(*r));
+				r = atom_term(",", move(args));
+			}
 			auto t = context.get_token();
 			if (t->get_type() != symbol::rparen)
 				throw syntax_error(*t, ") expected");
@@ -400,7 +547,7 @@ exp_return check_op(exp_param &param,
 		op_t &op = param.context.ops.getop(r.tok->get_text(),
 				param.priority);
 		if (!op.null() && op.get_pred() == param.priority) {
-			uint64_t id = atom_id.get_id(r.tok->get_text());
+			uint64_t id = atoms->get_id(r.tok->get_text());
 			r.tok->id = id;
 			return f(param, op, r);
 		}
@@ -419,6 +566,16 @@ exp_return parse_exp_prefix(exp_param &param, op_t &op, exp_return &r)
 		param.context.push(r.tok);
 		return move(r);
 	}
+	/* op(...) is an ordinary compound term, but op (...) is not */
+	unique_ptr<token> next = param.context.get_token();
+	bool call = next->get_type() == symbol::lparen && !next->is_spaced();
+	param.context.push(next);
+	if (call) {
+		r.ok = false;
+		r.cont = true;
+		param.context.push(r.tok);
+		return move(r);
+	}
 	if (op.noassoc()) {
 		p = parse_exp_next(param.context, param.priority);
 	} else
@@ -515,22 +672,25 @@ parse_expression_rules(interp_context &context)
 	return r;
 }
 
+/* the elements are read in a loop, so a long list does not nest calls */
 optional<p_term> parse_list(interp_context &context)
 {
 	unique_ptr<token> t;
 	optional<p_term> rtn;
-	p_term lnode, rnode;
-	if ((rtn = parse_expression(context))) {
-		lnode = move(*rtn);
+	vector<p_term> items;
+	p_term rnode;
+	while (true) {
+		if (!(rtn = parse_expression(context)))
+			throw syntax_error(context.get_position(),
+			    "list parsing error");
+		items.push_back(move(*rtn));
 		t = context.get_token();
 		if (!t)
 			return nullopt;
+		if (t->get_type() == symbol::comma)
+			continue;
 		if (t->get_type() == symbol::rbracket) {
-			auto n = make_unique<token>(symbol::atom);
-			n->set_text("[]");
-			uint64_t id = atom_id.get_id(n->get_text());
-			n->id = id;
-			rnode = make_unique<term>(move(n));
+			rnode = atom_term("[]");
 		} else if (t->get_type() == symbol::vbar) {
 			auto n = parse_expression(context);
 			if (!n)
@@ -539,23 +699,18 @@ optional<p_term> parse_list(interp_context &context)
 			auto r = context.get_token();
 			if (r->get_type()!= symbol::rbracket)
 				throw syntax_error(*r, "] expected");
-		} else if (t->get_type() == symbol::comma) {
-			rtn = parse_list(context);
-			if (!rtn)
-				throw syntax_error(*t, "expression expected");
-			rnode = move(*rtn);
 		} else
 			return nullopt;
-		auto n = make_unique<token>(symbol::atom);
+		break;
+	}
+	while (!items.empty()) {
 		vector<p_term> v;
-		v.push_back(move(lnode));
+		v.push_back(move(items.back()));
 		v.push_back(move(rnode));
-		n->set_text(".");
-		uint64_t id = atom_id.get_id(n->get_text());
-		n->id = id;
-		return make_unique<term>(move(n), move(v));
-	} else
-		throw syntax_error(*t, "list parsing error");
+		items.pop_back();
+		rnode = atom_term(".", move(v));
+	}
+	return rnode;
 }
 
 optional<p_term> parse_term(interp_context &context)
@@ -571,13 +726,21 @@ optional<p_term> parse_term(interp_context &context)
 			throw syntax_error(*t, "list parsing error");
 		return l;
 	} else if (t->get_type() == symbol::decimal) {
-		t->set_decimal_value(stof(t->get_text()));
+		/* strtod reads a subnormal such as 5.0e-324; stod throws */
+		double d = strtod(t->get_text().c_str(), nullptr);
+		if (isinf(d))
+			throw syntax_error(*t, "float out of range");
+		t->set_decimal_value(d);
 		r = make_unique<term>(move(t));
 	} else if (t->get_type() == symbol::integer) {
-		t->set_int_value(stoi(t->get_text()));
+		errno = 0;
+		long long i = strtoll(t->get_text().c_str(), nullptr, 10);
+		if (errno == ERANGE)
+			throw syntax_error(*t, "integer out of range");
+		t->set_int_value(i);
 		r = make_unique<term>(move(t));
 	} else if (t->get_type() == symbol::atom) {
-		uint64_t id = atom_id.get_id(t->get_text());
+		uint64_t id = atoms->get_id(t->get_text());
 		t->id = id;
 		unique_ptr<token> next = context.get_token();
 		if (next->get_type() == symbol::lparen) {
@@ -718,9 +881,83 @@ void op_directive(interp_context &context, vector<p_term> args)
 	context.ops.insert(op->get_text(), op_t {assoc, priority});
 }
 
+/* parallel(Workers) or parallel(Workers, unordered): how to search */
+void parallel_directive(interp_context &context, vector<p_term> args)
+{
+	if (args.empty() || args.size() > 2 ||
+	    args[0]->get_first()->get_type() != symbol::integer ||
+	    args[0]->get_first()->get_int_value() < 1 ||
+	    args[0]->get_first()->get_int_value() > UINT_MAX) {
+		cout << "parallel(workers) or parallel(workers, unordered)"
+		     << endl;
+		return;
+	}
+	context.search.workers = args[0]->get_first()->get_int_value();
+	context.search.ordered = args.size() == 1 ||
+	    args[1]->get_first()->get_text() != "unordered";
+	context.parallel = true;
+}
+
+/*
+ * table name/arity, ...: keep the answers of each call in a table. The
+ * specs may be separate arguments or a conjunction.
+ */
+void table_directive(interp_context &context, vector<p_term> args)
+{
+	vector<p_term> specs(args.rbegin(), args.rend());
+	while (!specs.empty()) {
+		p_term spec = move(specs.back());
+		specs.pop_back();
+		auto &f = spec->get_first();
+		auto &rest = spec->get_rest();
+		if (f->get_text() == "," && rest.size() == 2) {
+			specs.push_back(rest[1]);
+			specs.push_back(rest[0]);
+			continue;
+		}
+		if (f->get_text() != "/" || rest.size() != 2 ||
+		    rest[0]->get_first()->get_type() != symbol::atom ||
+		    !rest[0]->get_rest().empty() ||
+		    rest[1]->get_first()->get_type() != symbol::integer) {
+			cout << "table name/arity" << endl;
+			continue;
+		}
+		size_t arity = rest[1]->get_first()->get_int_value();
+		context.db->table(index_key {key_type::atom, arity,
+		                             rest[0]->get_first()->id});
+	}
+}
+
+/*
+ * set_prolog_flag(occurs_check, true|false): unify with the occurs check.
+ * set_prolog_flag(hash_consing, true|false): share the ground terms of
+ * the clauses that follow.
+ */
+void flag_directive(interp_context &context, vector<p_term> args)
+{
+	if (args.size() != 2 || !args[0]->get_rest().empty() ||
+	    !args[1]->get_rest().empty()) {
+		cout << "set_prolog_flag(flag, value)" << endl;
+		return;
+	}
+	const string &flag = args[0]->get_first()->get_text();
+	const string &value = args[1]->get_first()->get_text();
+	if (value != "true" && value != "false")
+		cout << "flag values are true or false" << endl;
+	else if (flag == "occurs_check")
+		occurs_check = value == "true";
+	else if (flag == "hash_consing")
+		context.db->share_ground(value == "true");
+	else
+		cout << "unknown flag " << flag << endl;
+}
+
 unordered_map<string, function<void(interp_context &, vector<p_term>)>>
 directive_map =
 	{{"op",              op_directive},
+	 {"table",           table_directive},
+	 {"parallel",        parallel_directive},
+	 {"set_prolog_flag", flag_directive},
 	 {"dynamic",         dummy_directive},
 	 {"multifile",       dummy_directive},
 	 {"discontiguous",   dummy_directive},
@@ -747,12 +984,29 @@ optional<p_term> parse_directive(interp_context &context)
 		context.push(t);
 		return nullopt;
 	}
-	optional<p_term> directive = parse_term(context);
+	optional<p_term> directive = parse_expression(context);
 	if (!directive) {
 		throw syntax_error(*t, "directive expected.");
 		return nullopt;
 	}
 	t = expect_period(context);
+	/* :- table a/1, b/1: a prefix operator takes the specs up to the . */
+	if (t->get_type() == symbol::comma &&
+	    (*directive)->get_rest().size() == 1) {
+		vector<p_term> specs {(*directive)->get_rest()[0]};
+		while (t->get_type() == symbol::comma) {
+			optional<p_term> spec = parse_expression(context);
+			if (!spec)
+				throw syntax_error(*t, "directive expected.");
+			specs.push_back(move(*spec));
+			t = expect_period(context);
+		}
+		p_term arg = move(specs.back());
+		for (size_t i = specs.size() - 1; i -- > 0; )
+			arg = atom_term(",", {move(specs[i]), move(arg)});
+		directive = atom_term((*directive)->get_first()->get_text(),
+		    {move(arg)});
+	}
 	if (t->get_type() != symbol::period) {
 		throw syntax_error(*t, "expect period at the end.");
 		return nullopt;
@@ -765,36 +1019,36 @@ optional<p_term> parse_directive(interp_context &context)
 uint64_t find_max_ids(const p_term &t)
 {
 	uint64_t max_id = 0;
-	const unique_ptr<token> &head = t->get_first();
-	if (head->get_type() == symbol::variable) {
-		if (head->id > max_id)
-			max_id = head->id;
-	} else {
-		for (auto &i : t->get_rest()) {
-			uint64_t local = find_max_ids(i);
-			if (local > max_id)
-				max_id = local;
-		}
+	vector<term *> walk {t.get()};
+	while (!walk.empty()) {
+		term *n = walk.back();
+		walk.pop_back();
+		const unique_ptr<token> &head = n->get_first();
+		if (head->get_type() == symbol::variable)
+			max_id = max(max_id, head->id);
+		for (auto &i : n->get_rest())
+			walk.push_back(i.get());
 	}
-	return (max_id);
+	return max_id;
 }
 
 // find the number of variables
 void scan_vars(const p_term &t, uint64_t base,
 		unordered_map<uint64_t, string> &m)
 {
-	const unique_ptr<token> &head = t->get_first();
-	if (head->get_type() == symbol::variable) {
-		uint64_t id = head->id + base;
-		string s = head->get_text();
-		if (s == "_")
-			return;
-		auto i = m.find(id);
-		if (i == m.end())
-			m.insert(make_pair<uint64_t,string>(move(id), move(s)));
-	} else {
-		for (auto &i : t->get_rest())
-			scan_vars(i, base, m);
+	vector<term *> walk {t.get()};
+	while (!walk.empty()) {
+		term *n = walk.back();
+		walk.pop_back();
+		const unique_ptr<token> &head = n->get_first();
+		if (head->get_type() != symbol::variable) {
+			auto &rest = n->get_rest();
+			for (auto i = rest.rbegin(); i != rest.rend(); i ++)
+				walk.push_back(i->get());
+			continue;
+		}
+		if (head->get_text() != "_")
+			m.emplace(head->id + base, head->get_text());
 	}
 }
 
@@ -809,33 +1063,348 @@ optional<p_term> get_term(string source)
 	return parse_expression(context);
 }
 
-bool program(vector<istream *>ios)
+/* read one stream to the end */
+static void consult(interp_context &context, istream *in, clause_index &index)
 {
-	interp_context context {ios};
 	optional<p_clause> c;
-	vector<p_clause> cs;
 	vector<p_term> q;
 	optional<p_term> d;
 	vector<p_term> directives;
-	bool quit = false;
 
-	context.ins_transformer(string_transformer);
-	while (!quit) {
+	context.push_input_stream(in);
+	while (true) {
+		unique_ptr<token> t = context.get_token();
+		if (t->get_type() == symbol::eof)
+			break;
+		context.push(t);
 		try {
 			if ((d = parse_directive(context)))
 				directives.push_back(*d);
 			else if ((c = parse_clause(context)))
-				cs.push_back(move(*c));
+				index.add(compile((*c)->head, (*c)->body));
 			else if (!(q = parse_query(context)).empty())
-				solve(cs, q, var_id.max());
-			unique_ptr<token> t = context.get_token();
-			if (t->get_type() != symbol::eof)
-				context.push(t);
-			else
-				quit = true;
+				solve(index, q, var_id.max(), context.search);
 		} catch(syntax_error &e) {
 			cerr << e.what() << endl;
+			/* resume at the next clause */
+			do
+				t = expect_period(context);
+			while (t->get_type() != symbol::period &&
+			    t->get_type() != symbol::eof);
 		}
 	}
+}
+
+/*
+ * Answer queries from in until it ends. A query may leave out the ?-.
+ * Each answer is one line of bindings, or yes; a last line starting
+ * with % tells how the query ended (every answer found, the limit on
+ * answers or time reached, or an error) and how long it took. An error
+ * ends only its own request. The response is built in a buffer and
+ * written out in one go.
+ */
+static void serve(interp_context &context, istream *in, ostream &out,
+    const clause_index &index, const query_limits &limits)
+{
+	static const char *ends[] = {"exhausted", "limit", "timeout", "stopped"};
+	const size_t chunk = 1 << 16;
+	string buf;
+	char line[64];
+
+	context.push_input_stream(in);
+	while (true) {
+		unique_ptr<token> t = context.get_token();
+		if (t->get_type() == symbol::eof)
+			break;
+		if (t->get_type() != symbol::query) {
+			context.push(t);
+			t = make_unique<token>(symbol::query);
+		}
+		context.push(t);
+
+		auto start = chrono::steady_clock::now();
+		uint64_t n = 0;
+		const char *end;
+		bool parsed = false;
+		buf.clear();
+		try {
+			vector<p_term> q = parse_query(context);
+			parsed = true;
+			query_end e = each_answer(index, q, var_id.max(), limits,
+			    context.search.profile, [&](const binding_list &b) {
+				for (size_t i = 0; i < b.size(); i ++) {
+					if (i)
+						buf += ", ";
+					buf += b[i].first;
+					buf += "=>";
+					buf += b[i].second;
+				}
+				if (b.empty())
+					buf += "yes";
+				buf += '\n';
+				n ++;
+				/* a long answer set goes out as it grows */
+				if (buf.size() >= chunk) {
+					out.write(buf.data(), buf.size());
+					buf.clear();
+				}
+				return bool(out);
+			});
+			end = ends[int(e)];
+		} catch(exception &e) {
+			/* whatever goes wrong, only this request fails */
+			buf += "% ";
+			buf += e.what();
+			buf += '\n';
+			end = "error";
+			/* resume at the next query */
+			if (!parsed)
+				do
+					t = expect_period(context);
+				while (t->get_type() != symbol::period &&
+				    t->get_type() != symbol::eof);
+		}
+		chrono::duration<double, milli> ms =
+		    chrono::steady_clock::now() - start;
+		snprintf(line, sizeof line, "%% %s, %llu answers, %.3f ms\n",
+		    end, (unsigned long long) n, ms.count());
+		buf += line;
+		out.write(buf.data(), buf.size());
+		if (!out.flush())
+			break;
+	}
+}
+
+/*
+ * Split a file into about n pieces at clause ends. Nothing comes back if
+ * the file holds anything but facts: a :- or ?- outside brackets, or a
+ * token the scanner cannot finish.
+ */
+static optional<vector<size_t>> fact_chunks(const string &text, size_t n)
+{
+	const char *begin = text.data(), *p = begin, *end = p + text.size();
+	vector<size_t> cuts {0};
+	size_t depth = 0, step = text.size() / n;
+
+	while (p != end) {
+		auto s = scan(p, end);
+		switch (s.first) {
+		case symbol::lparen:
+		case symbol::lbracket:
+			depth ++;
+			break;
+		case symbol::rparen:
+		case symbol::rbracket:
+			if (depth)
+				depth --;
+			break;
+		case symbol::rules:
+		case symbol::query:
+			if (!depth)
+				return nullopt;
+			break;
+		case symbol::append:
+		case symbol::error:
+			return nullopt;
+		case symbol::atom:
+			if (!depth && s.second == 1 && *p == '.' &&
+			    (p + 1 == end || space(p[1])) &&
+			    size_t(p + 1 - begin) >= cuts.size() * step)
+				cuts.push_back(p + 1 - begin);
+			break;
+		default:
+			break;
+		}
+		p += s.second;
+	}
+	cuts.back() = text.size();
+	return cuts;
+}
+
+/* an input stream over text already in memory */
+struct text_buf : public streambuf {
+	text_buf(const char *begin, const char *end) {
+		char *b = const_cast<char *>(begin);
+		setg(b, b, b + (end - begin));
+	}
+};
+
+struct fact_chunk {
+	unique_id      atoms;
+	vector<p_code> clauses;
+	bool           ok;
+};
+
+static void parse_facts(const char *begin, const char *end,
+    const operator_t &ops, fact_chunk &out)
+{
+	text_buf buf {begin, end};
+	istream in {&buf};
+	interp_context context {ops};
+	optional<p_clause> c;
+
+	atoms = &out.atoms;
+	context.ins_transformer(string_transformer);
+	context.push_input_stream(&in);
+	out.ok = false;
+	try {
+		while (true) {
+			unique_ptr<token> t = context.get_token();
+			if (t->get_type() == symbol::eof)
+				break;
+			context.push(t);
+			if (!(c = parse_clause(context)) || !(*c)->body.empty())
+				return;
+			out.clauses.push_back(compile((*c)->head, (*c)->body));
+		}
+	} catch(syntax_error &) {
+		return;
+	}
+	out.ok = true;
+}
+
+/*
+ * A large file of nothing but facts is parsed by several threads, each
+ * with its own atom table; the clauses are then renamed into the global
+ * table and indexed in file order, just as a sequential consult would.
+ */
+static bool load_facts(interp_context &context, const string &text,
+    clause_index &index)
+{
+	const size_t min_chunk = 1 << 18;
+	size_t n = min(size_t(thread::hardware_concurrency()),
+	               text.size() / min_chunk);
+	if (n < 2)
+		return false;
+	auto cuts = fact_chunks(text, n);
+	if (!cuts)
+		return false;
+
+	vector<fact_chunk> chunks(cuts->size() - 1);
+	vector<thread> workers;
+	for (size_t i = 0; i < chunks.size(); i ++)
+		workers.emplace_back(parse_facts, text.data() + (*cuts)[i],
+		    text.data() + (*cuts)[i + 1], cref(context.ops),
+		    ref(chunks[i]));
+	for (auto &w : workers)
+		w.join();
+	for (auto &c : chunks)
+		if (!c.ok)
+			return false;
+	for (auto &c : chunks) {
+		vector<uint64_t> map(c.atoms.max() + 1);
+		for (uint64_t id = 1; id < map.size(); id ++)
+			map[id] = atom_id.get_id(c.atoms.get_name(id));
+		for (auto &code : c.clauses) {
+			rename_atoms(*code, map);
+			index.add(move(code));
+		}
+	}
+	return true;
+}
+
+/* the state a program image keeps besides its clauses */
+static vector<op_entry> image_ops(const operator_t &ops)
+{
+	vector<op_entry> all;
+	for (auto &o : ops.all())
+		all.push_back(op_entry {o.first, uint32_t(o.second.get_assoc()),
+		                        o.second.get_pred()});
+	sort(all.begin(), all.end(), [](auto &a, auto &b) {
+		return tie(a.name, a.priority, a.assoc) <
+		       tie(b.name, b.priority, b.assoc); });
+	return all;
+}
+
+static bool load_image(interp_context &context, const string &text,
+    clause_index &index)
+{
+	vector<op_entry> ops;
+	image_flags flags;
+	if (!load_image(text, index, ops, flags))
+		return false;
+	for (auto &o : ops)
+		if (!context.ops.getop(o.name, o.priority).get_pred())
+			context.ops.insert(o.name,
+			    op_t {assoc_t(o.assoc), o.priority});
+	/* the image's directives go on holding, as the program's would */
+	occurs_check = flags.occurs_check;
+	index.share_ground(flags.hash_consing);
+	if (flags.workers) {
+		context.search.workers = flags.workers;
+		context.search.ordered = flags.ordered;
+		context.parallel = true;
+	}
 	return true;
 }
+
+static bool write_image(const string &path, const interp_context &context,
+    const clause_index &index)
+{
+	image_flags flags {context.parallel ? context.search.workers : 0,
+	    context.search.ordered, occurs_check, index.shares_ground()};
+	string image = save_image(index, image_ops(context.ops), flags);
+	ofstream out {path, ios::binary | ios::trunc};
+	out.write(image.data(), image.size());
+	return bool(out.flush());
+}
+
+bool program(vector<istream *>ios, const search_opts &search,
+    const string &image, const serve_opts &server)
+{
+	interp_context context;
+	clause_index index;
+
+	context.db = &index;
+	context.search = search;
+	context.ins_transformer(string_transformer);
+	for (auto in = ios.rbegin(); in != ios.rend(); in ++) {
+		auto file = dynamic_cast<ifstream *>(*in);
+		if (!file) {
+			consult(context, *in, index);
+			continue;
+		}
+		string text;
+		if (file->seekg(0, ios::end)) {
+			text.resize(file->tellg());
+			file->seekg(0).read(&text[0], text.size());
+			text.resize(file->gcount());
+		}
+		if (is_image(text)) {
+			if (!load_image(context, text, index))
+				cerr << "unusable program image" << endl;
+			continue;
+		}
+		if (!load_facts(context, text, index)) {
+			text_buf buf {text.data(), text.data() + text.size()};
+			istream s {&buf};
+			consult(context, &s, index);
+		}
+	}
+	bool ok = true;
+	if (!image.empty() && !write_image(image, context, index)) {
+		cerr << image << ": cannot write program image" << endl;
+		ok = false;
+	} else if (server.enabled && server.socket.empty()) {
+		serve(context, &cin, cout, index, server.limits);
+	} else if (server.enabled) {
+		const char *why = serve_socket(server.socket,
+		    [&](istream &in, ostream &out) {
+			interp_context c {context.ops};
+			c.db = &index;
+			c.search = context.search;
+			c.interactive = true;
+			c.ins_transformer(string_transformer);
+			serve(c, &in, out, index, server.limits);
+			/* the server runs until stopped: report as sessions end */
+			if (search.profile)
+				print_profile(cerr);
+		});
+		cerr << server.socket << ": " << why << endl;
+		ok = false;
+	}
+	/* everything run: queries in the files, then any served */
+	if (search.profile)
+		print_profile(cerr);
+	return ok;
+}
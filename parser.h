@@ -4,8 +4,8 @@
 #include <memory>
 #include <string>
 #include <sstream>
-#include <regex>
 #include <cassert>
+#include <optional>
 #include <cstdint>
 #include <vector>
 #include <set>
@@ -20,14 +20,14 @@ namespace {
 	using std::set;
 	using std::unique_ptr;
 	using std::shared_ptr;
-	using std::regex;
 	using std::optional;
 	using std::unordered_map;
 	using std::stringstream;
 	using std::string;
 }
 
-extern unique_id atom_id, var_id;
+extern unique_id atom_id;
+extern thread_local unique_id var_id;
 
 enum class symbol { none, atom, ignore, append, integer, decimal, string,
                     variable, error, lparen, rparen, lbracket, rbracket,
@@ -42,28 +42,17 @@ private:
 	symbol     token_type;
 	position_t position;
 	symflags   flag;
-	int        int_value;
-	float      decimal_value;
+	int64_t    int_value;
+	double     decimal_value;
+	bool       spaced;       /* layout or a comment came before it */
 public:
-	token(symbol type) : token_type {type}, flag {symflags::none} {}
+	token(symbol type) : token_type {type}, flag {symflags::none},
+		spaced {false} {}
 	token() : token(symbol::error) {}
-	void  set_int_value(int v) { int_value = v;}
-	int   get_int_value() { return int_value; }
-	void  set_decimal_value(float v) { decimal_value = v;}
-	float get_decimal_value() { return decimal_value; }
-	bool  match(string::const_iterator begin,
-			string::const_iterator end,
-			const regex &pat, symbol type) {
-		std::smatch m;
-		if (regex_search(begin, end, m, pat)) {
-			token_type = type;
-			text = m.begin()->str();
-			return true;
-		} else {
-			token_type = symbol::error;
-			return false;
-		}
-	}
+	void    set_int_value(int64_t v) { int_value = v;}
+	int64_t get_int_value() { return int_value; }
+	void    set_decimal_value(double v) { decimal_value = v;}
+	double  get_decimal_value() { return decimal_value; }
 	void set_flag(symflags s) { flag = s; }
 	symflags get_flag() { return flag; }
 	void set_text(string t) { text = t; }
@@ -72,6 +61,8 @@ public:
 	void set_type(const symbol type) { token_type = type; }
 	void set_position(const position_t & p) { position = p; }
 	const position_t & get_position() const { return position; }
+	void set_spaced(bool s) { spaced = s; }
+	bool is_spaced() const { return spaced; }
 	uint64_t id;
 };
 
@@ -80,13 +71,32 @@ private:
 	unique_ptr<token> first;
 	vector<shared_ptr<term>> rest;
 	int ident;
+	bool ground;
 public:
 	term(unique_ptr<token> f, vector<shared_ptr<term>> r) :
-		first{move(f)}, rest{move(r)}, ident{0} {}
-	term(unique_ptr<token> f) : first{move(f)}, ident{0} {}
+		first{move(f)}, rest{move(r)}, ident{0} {
+		ground = first->get_type() != symbol::variable;
+		for (auto &i : rest)
+			ground = ground && i->ground;
+	}
+	term(unique_ptr<token> f) : first{move(f)}, ident{0}
+	{ ground = first->get_type() != symbol::variable; }
 	term(const term& t) = delete;
+	/* children are freed in a loop, so a long list does not nest calls */
+	~term() {
+		vector<shared_ptr<term>> stack;
+		stack.swap(rest);
+		while (!stack.empty()) {
+			shared_ptr<term> t = move(stack.back());
+			stack.pop_back();
+			if (t.use_count() == 1)
+				for (auto &i : t->rest)
+					stack.push_back(move(i));
+		}
+	}
 	const unique_ptr<token> &get_first() { return first; }
 	const auto &get_rest () { return rest;  }
+	bool is_ground() const { return ground; }
 	void set_ident(int idt) { ident = idt;  }
 	friend ostream& operator<<(ostream& os, const term& c);
 };
@@ -115,7 +125,10 @@ public:
 };
 using p_clause = unique_ptr<clause>;
 
-bool program(vector<istream *>);
+struct search_opts;
+struct serve_opts;
+bool program(vector<istream *>, const search_opts &, const string &image,
+    const serve_opts &);
 optional<p_term> get_term(string);
 optional<p_term> external_parse_term(string);
 string conv2escape(string);
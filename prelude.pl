@@ -36,6 +36,7 @@
 :- op(1000, xfx, ',').
 :- op(1050, xfy, ->).
 :- op(1100, xfy, ';').
+:- op(1150, fx, table).
 :- op(1200, fx, ':-').
 :- op(1200, xfx, ':-').
 :- op(1200, xfx, -->).
@@ -62,6 +63,7 @@ different(X, Y).
 not(P) :- P,!,fail.
 not(P) :- true.
 \+ P :- not(P).
+','(A, B) :- A, B.
 atom_length(Atom,Integer):-atom_chars(Atom,C), length(C,Integer).
 atom_concat(Atom1,Atom2,Atom3):-atom_chars(Atom1,C1),atom_chars(Atom2,C2),conc(C1,C2,C3),atom_chars(Atom3,C3).
 drop([], N, []).
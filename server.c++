@@ -0,0 +1,111 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+using namespace std;
+
+/* a stream buffer over a file descriptor, buffered both ways */
+class fd_buf : public streambuf {
+private:
+	static const size_t size = 1 << 16;
+	int  fd;
+	char in[size], out[size];
+	bool drain() {
+		for (char *p = pbase(); p < pptr(); ) {
+			ssize_t n = write(fd, p, pptr() - p);
+			if (n <= 0)
+				return false;
+			p += n;
+		}
+		setp(out, out + size);
+		return true;
+	}
+protected:
+	int underflow() override {
+		ssize_t n = read(fd, in, size);
+		if (n <= 0)
+			return traits_type::eof();
+		setg(in, in, in + n);
+		return traits_type::to_int_type(*in);
+	}
+	int overflow(int c) override {
+		if (!drain())
+			return traits_type::eof();
+		if (c != traits_type::eof())
+			sputc(c);
+		return traits_type::not_eof(c);
+	}
+	int sync() override { return drain() ? 0 : -1; }
+public:
+	fd_buf(int f) : fd {f} {
+		setg(in, in, in);
+		setp(out, out + size);
+	}
+	~fd_buf() { drain(); close(fd); }
+};
+
+/* the sessions running, so the server can wait for them before it ends */
+struct sessions {
+	mutex              lock;
+	condition_variable done;
+	size_t             running = 0;
+};
+
+static void connection(int fd, session_fn session, sessions &live)
+{
+	{
+		fd_buf buf {fd};
+		istream in {&buf};
+		ostream out {&buf};
+		session(in, out);
+	}
+	lock_guard<mutex> l {live.lock};
+	live.running --;
+	live.done.notify_all();
+}
+
+const char *serve_socket(const string &path, const session_fn &session)
+{
+	sockaddr_un addr {};
+	sessions live;
+	int s;
+
+	if (path.size() >= sizeof addr.sun_path)
+		return "socket path too long";
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return "cannot create socket";
+	unlink(path.c_str());
+	if (bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 ||
+	    listen(s, 64) < 0) {
+		close(s);
+		return "cannot listen";
+	}
+	/* a client that goes away is its own session's business */
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		int c = accept(s, nullptr, nullptr);
+		if (c < 0 && (errno == EINTR || errno == ECONNABORTED))
+			continue;
+		if (c < 0)
+			break;
+		lock_guard<mutex> l {live.lock};
+		live.running ++;
+		thread {connection, c, session, ref(live)}.detach();
+	}
+	close(s);
+	/* what the sessions use lives as long as they do */
+	unique_lock<mutex> l {live.lock};
+	live.done.wait(l, [&] { return live.running == 0; });
+	return "cannot accept connections";
+}
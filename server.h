@@ -0,0 +1,15 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <functional>
+
+/*
+ * Accept connections on a local (Unix domain) socket at path, running a
+ * copy of session on a thread of its own for each, with streams reading
+ * from and writing to the connection. It serves until the process is
+ * stopped; if the socket cannot be set up, or accepting fails, it waits
+ * for the sessions still running and returns why it stopped.
+ */
+using session_fn = std::function<void(std::istream &, std::ostream &)>;
+
+const char *serve_socket(const std::string &path, const session_fn &session);
@@ -0,0 +1,159 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include "table.h"
+
+using namespace std;
+
+/*
+ * Copy a term out of the binding store into code of its own, laid out as
+ * the compiler lays out a fact: fun cells follow their str cells, and
+ * variables are numbered from 1 in order of first occurrence. Two variant
+ * terms therefore copy to the same cells. A str cell holds the index of
+ * its fun cell until the copy is done and the cells stop moving.
+ *
+ * A compound met again inside itself, which only a binding can lead to,
+ * is copied as a fresh variable wherever it occurs, and a body goal V = T
+ * binds that variable to the compound's copy when the code is run.
+ */
+p_code copy_term(const value &v, const var_lookup &table)
+{
+	const size_t done = SIZE_MAX;   /* a compound's arguments are copied */
+	p_code c = make_unique<code>();
+	vector<cell> &cells = c->cells;
+	vector<pair<size_t, value>> walk {{0, v}};
+	unordered_map<uint64_t, uint64_t> vars;
+	uint64_t nvars = 0;
+	/* compounds being copied: their fun cell, and the cell naming them */
+	unordered_map<visit, pair<size_t, size_t>, visit_hash> open;
+	vector<pair<uint64_t, size_t>> loops;   /* variable, fun cell */
+
+	cells.emplace_back();
+	while (!walk.empty()) {
+		size_t at = walk.back().first;
+		value w = walk.back().second, x = table.deref(w);
+		walk.pop_back();
+		if (at == done) {
+			open.erase(visit {w.p, w.base, nullptr, 0});
+			continue;
+		}
+		switch (x.t) {
+		case tag::ref: {
+			auto i = vars.emplace(x.id, nvars + 1);
+			if (i.second)
+				nvars ++;
+			cells[at] = cell {tag::var, i.first->second};
+			break;
+		}
+		case tag::atom:
+			cells[at] = cell {tag::atom, x.id};
+			break;
+		case tag::integer:
+			cells[at] = cell {x.i};
+			break;
+		case tag::decimal:
+			cells[at] = cell {x.d};
+			break;
+		case tag::str: {
+			size_t f = cells.size(), n = x.p->n;
+			if (w.t == tag::ref && !x.p->is_ground()) {
+				auto o = open.emplace(
+				    visit {x.p, x.base, nullptr, 0},
+				    make_pair(f, at));
+				if (!o.second) {
+					cell &outer = cells[o.first->second.second];
+					if (outer.t != tag::var) {
+						loops.emplace_back(++ nvars,
+						    o.first->second.first);
+						outer = cell {tag::var, nvars};
+					}
+					cells[at] = outer;
+					break;
+				}
+				walk.emplace_back(done, x);
+			}
+			cells.resize(f + 1 + n);
+			cells[f] = cell {tag::fun, x.p->id, uint32_t(n)};
+			cells[at] = cell {tag::str, f};
+			for (size_t i = n; i > 0; i --)
+				walk.emplace_back(f + i,
+				    arg_value(x.p + i, x.base));
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	static const uint64_t eq = atom_id.get_id("=");
+	vector<size_t> body;
+	for (auto &l : loops) {
+		body.push_back(cells.size());
+		cells.emplace_back(tag::str, cells.size() + 1);
+		cells.emplace_back(tag::fun, eq, 2);
+		cells.emplace_back(tag::var, l.first);
+		cells.emplace_back(tag::str, l.second);
+	}
+	/* arguments come after their fun cell: mark ground ones bottom up */
+	for (size_t f = cells.size(); f -- > 0; ) {
+		if (cells[f].t != tag::fun)
+			continue;
+		bool ground = true;
+		for (size_t i = 1; i <= cells[f].n && ground; i ++) {
+			const cell &a = cells[f + i];
+			if (a.t == tag::var || (a.t == tag::str &&
+			    !cells[a.id].is_ground()))
+				ground = false;
+		}
+		if (ground)
+			cells[f].flags |= cell_ground;
+	}
+	for (auto &i : cells)
+		if (i.t == tag::str)
+			i.p = &cells[i.id];
+	c->head = &cells[0];
+	for (auto i : body)
+		c->body.push_back(&cells[i]);
+	c->nvars = nvars;
+	return c;
+}
+
+/* the cells of a copy as bytes, with str cells by offset */
+string variant_key(const code &c)
+{
+	string key;
+	key.reserve(c.cells.size() * (sizeof(cell) - 2));
+	for (auto &i : c.cells) {
+		uint64_t payload = i.id;
+		if (i.t == tag::str)
+			payload = i.p - &c.cells[0];
+		key.push_back(char(i.t));
+		key.append(reinterpret_cast<const char *>(&i.n), sizeof i.n);
+		key.append(reinterpret_cast<const char *>(&payload),
+		    sizeof payload);
+	}
+	return key;
+}
+
+bool answer_table::add(p_code a)
+{
+	if (!seen.insert(variant_key(*a)).second)
+		return false;
+	answers.push_back(a.get());
+	owned.push_back(move(a));
+	return true;
+}
+
+answer_table &table_store::find(const value &goal, const var_lookup &table)
+{
+	p_code call = copy_term(goal, table);
+	auto &t = tables[variant_key(*call)];
+	if (!t) {
+		t = make_unique<answer_table>();
+		call->body.push_back(call->head);
+		call->head = nullptr;
+		t->call = move(call);
+	}
+	return *t;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "cell.h"
+#include "index.h"
+#include "unification.h"
+
+namespace {
+	using std::string;
+	using std::vector;
+	using std::unique_ptr;
+	using std::unordered_map;
+	using std::unordered_set;
+}
+
+/*
+ * Tabling. A call to a predicate declared with :- table is looked up by
+ * its variant (the call up to renaming of variables). The first time a
+ * variant is met its clauses are run to exhaustion and every distinct
+ * answer is kept; the call then resolves against the answers as if they
+ * were facts, and so does every later call of the same variant.
+ *
+ * A call that meets a variant still being evaluated further up consumes
+ * the answers found so far instead of recursing. The evaluation it
+ * depends on is repeated until no new answer turns up, and every table
+ * it involved is complete from then on.
+ */
+enum class table_state { fresh, evaluating, incomplete, complete };
+
+struct answer_table {
+	table_state           state;
+	size_t                depth;      /* on the evaluation stack */
+	size_t                low;        /* oldest evaluation depended on */
+	bool                  recursive;  /* met a variant under evaluation */
+	p_code                call;       /* the variant, as a query */
+	vector<p_code>        owned;
+	clause_list           answers;
+	unordered_set<string> seen;
+	answer_table() : state {table_state::fresh}, depth {0}, low {0},
+	    recursive {false} {}
+	bool add(p_code);
+};
+
+class table_store {
+private:
+	unordered_map<string, unique_ptr<answer_table>> tables;
+public:
+	vector<answer_table *> stack;     /* being evaluated, outermost first */
+	vector<answer_table *> pending;   /* incomplete, waiting on a leader */
+	uint64_t               added;     /* answers kept so far */
+	table_store() : added {0} {}
+	answer_table &find(const value &, const var_lookup &);
+};
+
+p_code copy_term(const value &, const var_lookup &);
+string variant_key(const code &);
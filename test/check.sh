@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Checks the corpus cannot make: programs run with options, whose output
+# is compared with what is expected. Prints what differs and exits
+# non-zero if anything did.
+#
+# usage: test/check.sh [path/to/prolog]
+
+PROLOG=${1:-./prolog}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+status=0
+
+# expect name: $TMP/out against the expected output on standard input
+expect() {
+	if ! diff -u - "$TMP/out" > "$TMP/diff"; then
+		echo "$1: unexpected output"
+		cat "$TMP/diff"
+		status=1
+	fi
+}
+
+# -p: a call that has exited fails when it is backtracked into
+cat > "$TMP/ports.pl" <<'PL'
+q(1). q(2). r(1).
+p :- q(X), r(Y), X > 5.
+?- p.
+PL
+"$PROLOG" -p "$ROOT/prelude.pl" "$TMP/ports.pl" < /dev/null 2>&1 \
+    > /dev/null | grep -v predicate | LC_ALL=C sort > "$TMP/out"
+expect ports <<'OUT'
+% >/2                           2          0          2
+% p/0                           1          0          1
+% q/1                           1          1          1
+% r/1                           2          0          2
+OUT
+
+# -S: a request that fails to parse ends only itself
+printf 'X = 99999999999999999999.\nX = 1.\n' |
+    "$PROLOG" -S "$ROOT/prelude.pl" 2>&1 |
+    sed 's/, [0-9.]* ms$//' > "$TMP/out"
+expect server <<'OUT'
+% <1,5>: Syntax error: integer out of range
+% error, 0 answers
+X=>1
+% exhausted, 1 answers
+OUT
+
+# -j: a count of workers that is not a number is refused; 0 is one a core
+"$PROLOG" -j x "$ROOT/prelude.pl" < /dev/null > /dev/null 2>&1
+echo "rc $?" > "$TMP/out"
+echo '?- member(X, [a, b]).' > "$TMP/member.pl"
+"$PROLOG" -j 0 "$ROOT/prelude.pl" "$TMP/member.pl" < /dev/null >> "$TMP/out"
+expect workers <<'OUT'
+rc 2
+X=>a
+X=>b
+
+OUT
+
+# -c: an image keeps the flags its directives set
+cat > "$TMP/flags.pl" <<'PL'
+:- set_prolog_flag(occurs_check, true).
+loop(X) :- X = f(X).
+PL
+echo '?- loop(X).' > "$TMP/loop.pl"
+"$PROLOG" -c "$TMP/flags.img" "$ROOT/prelude.pl" "$TMP/flags.pl" \
+    < /dev/null > /dev/null
+"$PROLOG" "$TMP/flags.img" "$TMP/loop.pl" < /dev/null > "$TMP/out"
+expect image <<'OUT'
+no
+OUT
+
+exit $status
@@ -2,173 +2,431 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
-#include <optional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
 #include "parser.h"
 #include "unification.h"
 
 using namespace std;
 
-void remove_from_table(var_lookup &table, const vector<uint64_t> &list)
+counters &counters::operator+=(const counters &c)
 {
-	for (auto item : list)
-		assert(table.erase(item) == 1);
+	inferences += c.inferences;
+	unifications += c.unifications;
+	bindings += c.bindings;
+	choicepoints += c.choicepoints;
+	backtracks += c.backtracks;
+	cuts += c.cuts;
+	return *this;
 }
 
-const p_bind_value &
-variable_t::walk(const p_bind_value &fail, const var_lookup & table)
+bool occurs_check = false;
+
+/* counts of stores already retired, from every thread */
+static mutex totals_lock;
+static counters totals;
+
+void var_lookup::retire()
 {
-	auto entry = table.find(get_id());
-	if (entry == table.end())
-		return fail;
-	return entry->second->walk(entry->second, table);
+	lock_guard<mutex> l {totals_lock};
+	totals += count;
+	count = counters {};
 }
 
-p_bind_value create_bind_value(const p_term &term, uint64_t base,
-    const var_lookup &table)
+counters var_lookup::lifetime() const
 {
-	const unique_ptr<token> &tok = term->get_first();
-	if (tok->get_type() == symbol::integer)
-		return make_shared<primitive_t<int>>(tok->get_int_value());
-	if (tok->get_type() == symbol::decimal)
-		return make_shared<primitive_t<float>>(tok->get_decimal_value());
-	if (tok->get_type() == symbol::atom)
-		return make_shared<composite_t>(term, base);
-	p_bind_value t  = make_shared<variable_t>(term, base);
-	return t->walk(t, table);
+	lock_guard<mutex> l {totals_lock};
+	counters c = totals;
+	return c += count;
 }
 
-bool composite_t::loop(uint64_t id, const var_lookup &table)
+cell *arena::alloc(size_t n)
 {
-	for (auto &child : root->get_rest()) {
-		auto n = create_bind_value(child, get_base(), table);
-		if (n->loop(id, table))
+	while (true) {
+		if (top.block == blocks.size()) {
+			size_t size = max(n, chunk);
+			blocks.emplace_back(make_unique<cell[]>(size), size);
+			top.used = 0;
+		}
+		auto &b = blocks[top.block];
+		if (top.used + n <= b.second) {
+			cell *c = &b.first[top.used];
+			top.used += n;
+			return c;
+		}
+		if (top.used == 0) {
+			b.second = n;
+			b.first = make_unique<cell[]>(n);
+			continue;
+		}
+		top.block ++;
+		top.used = 0;
+	}
+}
+
+/* pins are nearly always taken on recent frames, so append is the norm */
+void var_lookup::pin(uint64_t base)
+{
+	auto i = pinned.end();
+	while (i != pinned.begin() && *(i - 1) > base)
+		i --;
+	if (i == pinned.begin() || *(i - 1) != base)
+		pinned.insert(i, base);
+}
+
+void var_lookup::bind(uint64_t id, const value &v)
+{
+	count.bindings ++;
+	if (v.t == tag::str && !v.p->is_ground() && v.base >= id)
+		pin(v.base);
+	else if (v.t == tag::ref && v.id > id)
+		pin(v.id - 1);
+	if (id >= slots.size())
+		slots.resize(id + 1);
+	slots[id] = v;
+	if (id <= barrier)
+		trail.push_back(id);
+}
+
+/* after a cut, entries above mark only matter if they predate barrier */
+void var_lookup::tidy(size_t mark)
+{
+	auto end = remove_if(trail.begin() + mark, trail.end(),
+	    [this](uint64_t id) { return id > barrier; });
+	trail.erase(end, trail.end());
+}
+
+void var_lookup::clear(uint64_t base, uint64_t n)
+{
+	if (base + n >= slots.size())
+		slots.resize(max(2 * slots.size(), size_t(base + n + 1)));
+	for (uint64_t i = base + 1; i <= base + n; i ++)
+		slots[i].t = tag::none;
+}
+
+void var_lookup::move(uint64_t from, uint64_t to, uint64_t n)
+{
+	for (uint64_t i = 1; i <= n; i ++)
+		slots[to + i] = slots[from + i];
+}
+
+/* does any slot of the frame at base refer to a frame at or above above */
+bool var_lookup::refers(uint64_t base, uint64_t n, uint64_t above) const
+{
+	for (uint64_t i = base + 1; i <= base + n; i ++) {
+		const value &v = slots[i];
+		if (v.t == tag::str && !v.p->is_ground() && v.base >= above)
+			return true;
+		if (v.t == tag::ref && v.id > above)
 			return true;
 	}
 	return false;
 }
 
-maybe_ids variable_t::unification(p_bind_value tgt,var_lookup &table, bool cmp)
-{
-	if (tgt->loop(get_id(), table))
-		return nullopt;
-	if (!cmp) {
-		table.insert(make_pair(get_id(), tgt));
-		vector<uint64_t> v { get_id() };
-		return v;
-	} else
-		return vector<uint64_t>();
-}
-
-maybe_ids composite_t::unification(p_bind_value tgt, var_lookup &table, bool cmp)
-{
-	shared_ptr<composite_t> c = dynamic_pointer_cast<composite_t>(tgt);
-	if (!c)
-		return nullopt;
-	if (c->get_id() != get_id())
-		return nullopt;
-	auto &a1 = get_root()->get_rest();
-	auto &a2 = c->get_root()->get_rest();
-	auto ss = a1.begin(), se = a1.end();
-	auto ds = a2.begin(), de = a2.end();
-	uint64_t srcoff = get_base(), dstoff = c->get_base();
-	vector<uint64_t> vars;
-	for (; ss != se && ds != de; ss ++, ds ++) {
-		maybe_ids r;
-		if ((r = ::unification(*ss,*ds, srcoff, dstoff, table, cmp))) {
-			vars.insert(vars.end(), r->begin(), r->end());
-		} else {
-			remove_from_table(table, vars);
-			return nullopt;
+/*
+ * Without the occurs check a term can contain itself, and a walk over it
+ * would never end. Once a walk has met walk_short compounds it records
+ * each one it meets, and meeting one again ends that branch: the store
+ * holds finitely many, so the walk ends. Short walks, which are most of
+ * them, record nothing and clear nothing.
+ */
+static const size_t walk_short = 64;
+
+static bool met_before(unordered_set<visit, visit_hash> &met, size_t &steps,
+    const visit &v)
+{
+	if (steps ++ < walk_short)
+		return false;
+	if (steps == walk_short + 1)
+		met.clear();
+	return !met.insert(v).second;
+}
+
+/* does variable id occur in v */
+bool var_lookup::occurs(uint64_t id, const value &v)
+{
+	if (v.t != tag::str || v.p->is_ground())
+		return false;
+	size_t steps = 0;
+	walk.clear();
+	walk.push_back(v);
+	while (!walk.empty()) {
+		value s = walk.back();
+		walk.pop_back();
+		if (met_before(walked, steps, visit {s.p, s.base, nullptr, 0}))
+			continue;
+		for (size_t i = 1; i <= s.p->n; i ++) {
+			value a = arg(s, i);
+			if (a.t == tag::ref && a.id == id)
+				return true;
+			if (a.t == tag::str && !a.p->is_ground())
+				walk.push_back(a);
 		}
 	}
-	if (ss == se && ds == de)
-		return move(vars);
-	remove_from_table(table, vars);
-	return nullopt;
+	return false;
 }
 
-template<typename T>
-maybe_ids primitive_t<T>::unification(p_bind_value tgt, var_lookup &table,
-    bool cmp)
+/*
+ * Unify without recursing: argument pairs still to be matched are kept on
+ * a work list that lives as long as the store, so a unification that
+ * does not bind anything allocates nothing. Of two variables the newer
+ * is bound to the older. Two cyclic terms unify if no pair of compounds
+ * met along the way clashes. Bindings made before a failure are left for the
+ * caller's backtracking to undo.
+ */
+bool var_lookup::unify(const value &a, const value &b, bool occurs_check)
 {
-	auto c = dynamic_pointer_cast<primitive_t<T>>(tgt);
-	if (!c)
-		return nullopt;
-	if (c->value == value)
-		return vector<uint64_t>();
-	else
-		return nullopt;
+	count.unifications ++;
+	size_t steps = 0;
+	pending.clear();
+	pending.emplace_back(a, b);
+	while (!pending.empty()) {
+		value x = deref(pending.back().first);
+		value y = deref(pending.back().second);
+		pending.pop_back();
+		if (x.t == tag::ref && y.t == tag::ref) {
+			if (x.id != y.id)
+				bind(max(x.id, y.id),
+				     x.id < y.id ? x : y);
+			continue;
+		}
+		if (x.t == tag::ref || y.t == tag::ref) {
+			if (y.t == tag::ref)
+				swap(x, y);
+			if (occurs_check && occurs(x.id, y))
+				return false;
+			bind(x.id, y);
+			continue;
+		}
+		if (x.t != y.t)
+			return false;
+		switch (x.t) {
+		case tag::atom:
+			if (x.id != y.id)
+				return false;
+			break;
+		case tag::integer:
+			if (x.i != y.i)
+				return false;
+			break;
+		case tag::decimal:
+			if (x.d != y.d)
+				return false;
+			break;
+		case tag::str:
+			if (x.p == y.p && (x.base == y.base || x.p->is_ground()))
+				break;
+			if (x.p->id != y.p->id || x.p->n != y.p->n)
+				return false;
+			if (met_before(met, steps,
+			    visit {x.p, x.base, y.p, y.base}))
+				break;
+			for (size_t i = x.p->n; i > 0; i --)
+				pending.emplace_back(arg_value(x.p + i, x.base),
+				                     arg_value(y.p + i, y.base));
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
 }
 
-maybe_ids unification(const p_term &src, const p_term &dst, uint64_t src_base,
-    uint64_t dst_base, var_lookup &table, bool cmp_only)
+/* structural identity: ==/2 */
+bool var_lookup::identical(const value &a, const value &b)
 {
-	p_bind_value src_value = create_bind_value(src, src_base, table);
-	p_bind_value dst_value = create_bind_value(dst, dst_base, table);
-
-	auto r = src_value->unification(dst_value, table, cmp_only);
-	if (!r)
-		r = dst_value->unification(src_value, table, cmp_only);
-	return r;
+	size_t steps = 0;
+	pending.clear();
+	pending.emplace_back(a, b);
+	while (!pending.empty()) {
+		value x = deref(pending.back().first);
+		value y = deref(pending.back().second);
+		pending.pop_back();
+		if (x.t != y.t)
+			return false;
+		switch (x.t) {
+		case tag::ref:
+		case tag::atom:
+			if (x.id != y.id)
+				return false;
+			break;
+		case tag::integer:
+			if (x.i != y.i)
+				return false;
+			break;
+		case tag::decimal:
+			if (x.d != y.d)
+				return false;
+			break;
+		case tag::str:
+			if (x.p == y.p && (x.base == y.base || x.p->is_ground()))
+				break;
+			if (x.p->id != y.p->id || x.p->n != y.p->n)
+				return false;
+			if (met_before(met, steps,
+			    visit {x.p, x.base, y.p, y.base}))
+				break;
+			for (size_t i = x.p->n; i > 0; i --)
+				pending.emplace_back(arg_value(x.p + i, x.base),
+				                     arg_value(y.p + i, y.base));
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
 }
 
-string variable_t::tostring(const var_lookup &table)
+/*
+ * The fewest digits that read back as the same double, with a point so
+ * that it reads back as a float and not an integer: 1e+20 prints as
+ * 1.0e+20.
+ */
+static void print_decimal(ostream &os, double d)
 {
-	stringstream os;
-	auto n = walk(p_bind_value {nullptr}, table);
-	if (!n)
-		os << get_root()->get_first()->get_text();
-	else
-		os << bind_env {n, table };
-	return os.str();
-}
-
-optional<string> composite_t::list2string(const var_lookup &table)
-{
-	string s1, s2;
-	const vector<p_term> &rest = get_root()->get_rest();
-	if (get_root()->get_first()->get_text() != "." || rest.size() != 2)
-		return nullopt;
-	const p_bind_value l = create_bind_value(rest[0], get_base(), table);
-	const p_bind_value r = create_bind_value(rest[1], get_base(), table);
-	s1 = "[";
-	s1 += l->tostring(table);
-	s2 = r->tostring(table);
-	if (s2 == "[]")
-		return s1 + "]";
-	else if (s2[0] == '[' && s2[s2.size() - 1] == ']')
-		return s1 + ", " + string(s2.begin() + 1, s2.end() - 1) + "]";
+	char buf[32];
+	for (int digits = 15; digits <= 17; digits ++) {
+		snprintf(buf, sizeof buf, "%.*g", digits, d);
+		if (strtod(buf, nullptr) == d)
+			break;
+	}
+	char *e = strchr(buf, 'e');
+	if (strchr(buf, '.') || strpbrk(buf, "ni"))
+		os << buf;
+	else if (e)
+		os.write(buf, e - buf) << ".0" << e;
 	else
-		return s1 + "| " + s2 + "]";
+		os << buf << ".0";
 }
 
-string composite_t::tostring(const var_lookup &table)
+/*
+ * Terms print through the bindings of their variables. Without the occurs
+ * check a term can contain itself: a binding met again while it is still
+ * being printed prints as its variable, so X = f(X) shows as f(X).
+ */
+class printer {
+private:
+	ostream                               &os;
+	const var_lookup                      &table;
+	const unordered_map<uint64_t, string> *names;
+	unordered_set<uint64_t>               open;
+	vector<uint64_t>                      entered;
+	void var(uint64_t id) {
+		if (names && names->count(id))
+			os << names->at(id);
+		else
+			os << "_" << id;
+	}
+	/* follow bindings from v; false if one of them is already open */
+	bool follow(value &v) {
+		const value *b;
+		while (v.t == tag::ref && (b = table.find(v.id))) {
+			if (!open.insert(v.id).second)
+				return false;
+			entered.push_back(v.id);
+			v = *b;
+		}
+		return true;
+	}
+	/*
+	 * A variable met again while its term is being printed. The one
+	 * met may be a clause's, with no name; a query variable bound to
+	 * the same term, if one is open, is printed instead.
+	 */
+	void again(const value &v) {
+		value to = table.deref(v);
+		if (names && !names->count(v.id))
+			for (auto id : entered) {
+				value w = table.deref(*table.find(id));
+				if (names->count(id) && w.t == to.t &&
+				    w.p == to.p && w.base == to.base) {
+					var(id);
+					return;
+				}
+			}
+		var(v.id);
+	}
+	void close(size_t mark) {
+		for (; entered.size() > mark; entered.pop_back())
+			open.erase(entered.back());
+	}
+	bool is_list(const value &v) const {
+		return v.t == tag::str && v.p->n == 2 &&
+		    atom_id.get_name(v.p->id) == ".";
+	}
+public:
+	printer(ostream &o, const var_lookup &t,
+	    const unordered_map<uint64_t, string> *n) :
+	    os {o}, table {t}, names {n} {}
+	void print(value v);
+};
+
+void printer::print(value v)
 {
-	stringstream os;
-	auto &rest = get_root()->get_rest();
-	auto a = list2string(table);
-	if (a) {
-		os << *a;
-		return os.str();
+	size_t mark = entered.size();
+	if (!follow(v)) {
+		again(v);
+		close(mark);
+		return;
 	}
-	os << get_root()->get_first()->get_text();
-	if (rest.empty())
-		return os.str();
-	os << "(";
-	auto item = rest.begin();
-	while (item != rest.end()) {
-		p_bind_value n = create_bind_value(*item, get_base(), table);
-		os << bind_env { n, table };
-		item ++;
-		if (item != rest.end())
-			os << ", ";
+	switch (v.t) {
+	case tag::ref:
+		var(v.id);
+		break;
+	case tag::atom:
+		os << atom_id.get_name(v.id);
+		break;
+	case tag::integer:
+		os << v.i;
+		break;
+	case tag::decimal:
+		print_decimal(os, v.d);
+		break;
+	case tag::str:
+		if (is_list(v)) {
+			os << "[";
+			while (true) {
+				print(arg_value(v.p + 1, v.base));
+				v = arg_value(v.p + 2, v.base);
+				if (!follow(v)) {
+					os << "| ";
+					again(v);
+					break;
+				}
+				if (is_list(v)) {
+					os << ", ";
+					continue;
+				}
+				if (v.t != tag::atom ||
+				    atom_id.get_name(v.id) != "[]") {
+					os << "| ";
+					print(v);
+				}
+				break;
+			}
+			os << "]";
+			break;
+		}
+		os << atom_id.get_name(v.p->id) << "(";
+		for (size_t i = 1; i <= v.p->n; i ++) {
+			print(arg_value(v.p + i, v.base));
+			if (i < v.p->n)
+				os << ", ";
+		}
+		os << ")";
+		break;
+	default:
+		break;
 	}
-	os << ")";
-	return os.str();
+	close(mark);
 }
 
 ostream &operator<<(ostream &os, const bind_env &b)
 {
-	os << b.node->tostring(b.map);
+	printer {os, b.map, b.names}.print(b.node);
 	return os;
 }
@@ -2,113 +2,178 @@
 #include <iostream>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <optional>
-#include <sstream>
-#include "parser.h"
+#include <string>
+#include "cell.h"
+#include "index.h"
 
 namespace {
 	using std::unordered_map;
-	using std::shared_ptr;
+	using std::unordered_set;
+	using std::unique_ptr;
 	using std::vector;
-	using std::optional;
+	using std::string;
 	using std::ostream;
-	using std::stringstream;
 	using std::pair;
-	using std::nullopt;
-	using std::function;
 }
 
 enum class control { none, fail, cut };
 
-using maybe_ids = optional<vector<uint64_t>>;
-class bind_value;
-using p_bind_value = shared_ptr<bind_value>;
-using var_lookup = unordered_map<uint64_t, p_bind_value>;
-using builtin_t = pair<control, vector<uint64_t>>;
+/*
+ * What the engine has done. A binding store counts for the queries it
+ * serves; retire() adds its counts to those of the whole process.
+ */
+struct counters {
+	uint64_t inferences;      /* goals called */
+	uint64_t unifications;
+	uint64_t bindings;
+	uint64_t choicepoints;
+	uint64_t backtracks;
+	uint64_t cuts;
+	counters &operator+=(const counters &);
+};
 
-class bind_value {
-public:
-	virtual optional<builtin_t> builtin(uint64_t, var_lookup &)
-	{ return nullopt; }
-	virtual string tostring(const var_lookup &) = 0;
-	virtual bool loop(uint64_t id, const var_lookup &) { return false; }
-	virtual maybe_ids unification(p_bind_value, var_lookup &, bool) = 0;
-	virtual const p_bind_value &walk(const p_bind_value &fail,
-	const var_lookup &table) { return fail; }
-	virtual optional<int> getint(var_lookup &) { return nullopt; }
-	virtual optional<float> getdecimal(var_lookup&) { return nullopt; }
-	virtual optional<string> getname(const var_lookup &) { return nullopt; }
-	virtual optional<string> atom2chars(const var_lookup &) {return nullopt; }
-	virtual optional<string> list2string(const var_lookup &) { return nullopt;}
+/*
+ * Cells built at run time. Storage is handed out in chunks that are kept
+ * for reuse, and everything allocated after a mark is given back at once
+ * when a choice point taken at that mark is resumed.
+ */
+struct heap_mark {
+	size_t block;
+	size_t used;
 };
 
-class composite_t : public bind_value {
+class arena {
 private:
-	bool loop(uint64_t, const var_lookup &) override;
-protected:
-	p_term   root;
-	uint64_t base;
+	static const size_t chunk = 4096;
+	vector<pair<unique_ptr<cell[]>, size_t>> blocks;
+	heap_mark top;
 public:
-	string tostring(const var_lookup &) override;
-	composite_t(const p_term &t, uint64_t b) : root {t}, base {b} {}
-	uint64_t get_base() { return base; }
-	const p_term &get_root() const { return root; }
-	maybe_ids unification(p_bind_value, var_lookup &, bool) override;
-	virtual uint64_t get_id() { return root->get_first()->id; }
-	optional<builtin_t> builtin(uint64_t, var_lookup &)override;
-	optional<int> getint(var_lookup &t) override;
-	optional<float> getdecimal(var_lookup&t) override;
-	optional<string> list2string(const var_lookup &) override;
-	optional<string> getname(const var_lookup &) override {
-		return root->get_first()->get_text(); }
-	optional<string> atom2chars(const var_lookup &) override;
+	arena() : top {0, 0} {}
+	cell *alloc(size_t n);
+	heap_mark mark() const { return top; }
+	void reset(const heap_mark &m) { top = m; }
 };
 
-class variable_t : public composite_t {
-private:
-	bool loop(uint64_t id, const var_lookup &) override
-	{ return id == get_id(); }
-public:
-	string tostring(const var_lookup &m) override;
-	maybe_ids unification(p_bind_value, var_lookup &, bool) override;
-	uint64_t get_id() override { return composite_t::get_id() + base; }
-	const p_bind_value &walk(const p_bind_value &fail,
-	     const var_lookup & table) override;
-	variable_t(const p_term &t, uint64_t b) : composite_t{t,b} {}
-	optional<int> getint(var_lookup &t) override;
-	optional<float>getdecimal(var_lookup &t)override;
-	optional<string> getname(const var_lookup &) override {return nullopt;}
+/*
+ * Whether unification checks that a variable is not bound to a term that
+ * contains it. Off by default, as in ISO: X = f(X) then succeeds and
+ * makes a cyclic term, and binding a variable costs the same however
+ * large its value. unify_with_occurs_check/2 always checks.
+ */
+extern bool occurs_check;
+
+/*
+ * A compound, or a pair of them, met by a walk over terms. Cyclic terms
+ * make walks that never end, so a long walk remembers what it has met.
+ */
+struct visit {
+	const cell *a;
+	uint64_t    abase;
+	const cell *b;
+	uint64_t    bbase;
+	bool operator==(const visit &v) const {
+		return a == v.a && abase == v.abase && b == v.b &&
+		    bbase == v.bbase;
+	}
+};
+
+struct visit_hash {
+	size_t operator()(const visit &v) const {
+		size_t h = std::hash<const cell *>()(v.a) ^ v.abase * 31;
+		return h * 1000003 ^ std::hash<const cell *>()(v.b) ^
+		    v.bbase * 17;
+	}
 };
 
-template <typename T>
-class primitive_t : public bind_value {
+/*
+ * Binding store. Variable ids index a flat array of slots; a frame of n
+ * variables allocated at base owns slots base+1..base+n, and frames are
+ * allocated in stack order so a lower id means an older variable.
+ *
+ * Only bindings of slots that predate the newest choice point (the
+ * barrier) are trailed: anything newer is thrown away when that choice
+ * point is resumed. Backtracking pops the trail back to the choice
+ * point's mark.
+ *
+ * The store also remembers which frames are referenced from slots older
+ * than themselves. A frame that is not pinned that way and is newer than
+ * every choice point can be reclaimed once its clause body is done.
+ */
+class var_lookup {
 private:
-	const T value;
+	vector<value>              slots;
+	vector<uint64_t>           trail;
+	vector<uint64_t>           pinned;   /* sorted */
+	uint64_t                   barrier;
+	vector<pair<value, value>> pending;  /* unification work list */
+	vector<value>              walk;     /* occurs check work list */
+	unordered_set<visit, visit_hash> met;     /* by unify, identical */
+	unordered_set<visit, visit_hash> walked;  /* by the occurs check */
+	bool occurs(uint64_t, const value &);
 public:
-	string tostring(const var_lookup &) override
-	{ stringstream os; os << value; return os.str(); }
-	primitive_t(const T v) : value {v} {}
-	maybe_ids unification(p_bind_value, var_lookup &, bool) override;
-	const T get_value() { return value; }
-	optional<int> getint(var_lookup &) override
-	{ if (typeid(int) == typeid(T)) return value; return nullopt;}
-	optional<float> getdecimal(var_lookup &) override
-	{ if (typeid(float) == typeid(T)) return value; return nullopt; }
+	arena                      heap;
+	counters                   count;
+	var_lookup() : barrier {0}, count {} {}
+	void retire();
+	counters lifetime() const;
+	size_t slots_size() const { return slots.size(); }
+	size_t trail_size() const { return trail.size(); }
+	const value *find(uint64_t id) const {
+		if (id >= slots.size() || slots[id].t == tag::none)
+			return nullptr;
+		return &slots[id];
+	}
+	value deref(value v) const {
+		while (v.t == tag::ref && v.id < slots.size() &&
+		       slots[v.id].t != tag::none)
+			v = slots[v.id];
+		return v;
+	}
+	value arg(const value &s, size_t i) const {
+		return deref(arg_value(s.p + i, s.base)); }
+	void bind(uint64_t id, const value &v);
+	bool unify(const value &, const value &, bool occurs = occurs_check);
+	bool identical(const value &, const value &);
+	size_t mark() const { return trail.size(); }
+	void undo(size_t mark) {
+		for (; trail.size() > mark; trail.pop_back())
+			slots[trail.back()].t = tag::none;
+	}
+	void set_barrier(uint64_t b) { barrier = b; }
+	uint64_t get_barrier() const { return barrier; }
+	void tidy(size_t mark);
+	void clear(uint64_t base, uint64_t n);
+	void move(uint64_t from, uint64_t to, uint64_t n);
+	bool refers(uint64_t base, uint64_t n, uint64_t above) const;
+	void pin(uint64_t base);
+	bool pinned_above(uint64_t base) const
+	{ return !pinned.empty() && pinned.back() >= base; }
+	void release(uint64_t top) {
+		while (!pinned.empty() && pinned.back() >= top)
+			pinned.pop_back();
+	}
 };
 
+/* unbound variables print by name when names has them, else as _id */
 class bind_env {
 private:
-	const p_bind_value &node;
-	const var_lookup &map;
+	const value                           node;
+	const var_lookup                      &map;
+	const unordered_map<uint64_t, string> *names;
 public:
-	bind_env(const p_bind_value &n, const var_lookup &m) : node {n}, map {m} {}
+	bind_env(const value &n, const var_lookup &m,
+	    const unordered_map<uint64_t, string> *v = nullptr) :
+	    node {n}, map {m}, names {v} {}
 	friend ostream &operator<<(ostream &, const bind_env &);
 };
 
-maybe_ids unification(const p_term &, const p_term &, uint64_t,
-    uint64_t, var_lookup &, bool compare_only = false);
-void remove_from_table(var_lookup &, const vector<uint64_t> &);
-p_bind_value create_bind_value(const p_term &, uint64_t, const var_lookup &);
-optional<builtin_t> builtin(const p_term &, uint64_t, var_lookup &);
-void print_variable(uint64_t id, var_lookup &);
+using builtin_fn = control (*)(const value &, var_lookup &);
+builtin_fn find_builtin(const index_key &);
+
+/* arithmetic: compiled goals, and terms only known at run time */
+control run_arith(const cell *goal, uint64_t base, var_lookup &);
+optional<number> eval(const value &, var_lookup &);
+value number_value(const number &);
+bool compare(opcode, const number &, const number &);
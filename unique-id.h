@@ -2,28 +2,57 @@
 
 #include <unordered_map>
 #include <string>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
 #include <cstdint>
 #include <iostream>
 
+/*
+ * Interned names. Lookups may come from several threads at once: names
+ * are kept in a deque so a reference handed out stays valid while other
+ * threads add to it.
+ */
 class unique_id {
 private:
 	std::unordered_map<std::string, uint64_t> id_map;
+	std::deque<std::string> names;
 	uint64_t magic;
+	mutable std::shared_mutex lock;
 public:
-	unique_id() : magic{0} {}
-	void clear() { id_map.clear(); }
-	uint64_t max() const {return magic;}
+	unique_id() : names{""}, magic{0} {}
+	void clear() {
+		std::unique_lock<std::shared_mutex> w {lock};
+		id_map.clear(); names.resize(1); magic = 0;
+	}
+	uint64_t max() const {
+		std::shared_lock<std::shared_mutex> r {lock};
+		return magic;
+	}
 	uint64_t get_id(const std::string &name) {
+		if (name != "_") {
+			std::shared_lock<std::shared_mutex> r {lock};
+			auto i = id_map.find(name);
+			if (i != id_map.end())
+				return i->second;
+		}
+		std::unique_lock<std::shared_mutex> w {lock};
 		if (name == "_") {
 			magic ++;
+			names.push_back(name);
 			return magic;
 		}
 		auto i = id_map.find(name);
 		if (i == id_map.end()) {
 			magic ++;
 			id_map.insert(make_pair(name, magic));
+			names.push_back(name);
 			return magic;
 		} else
 			return i->second;
 	}
+	const std::string &get_name(uint64_t id) const {
+		std::shared_lock<std::shared_mutex> r {lock};
+		return names[id];
+	}
 };